@@ -6,28 +6,30 @@
 
 namespace moducom { namespace dynamic {
 
-void MemoryPoolIndexedHandlePage::initialize(uint8_t free_page, uint8_t page_count)
+void MemoryPoolIndexedHandlePage::initialize(uint8_t free_page, uint8_t page_count, const Geometry* geometry)
 {
-    // TODO: refactor to make size 0 based, to increase usable space
-    header.size = 1;
     header.tier = IMemory::Indexed;
-    header.followup = false;
+    // directory occupies all pages up to free_page
+    initialize_directory(free_page, geometry);
+    // TODO: refactor to make size 0 based, to increase usable space
+    set_handle_count(1);
     // set up initial fully-empty handle
-    handle_t& handle = indexedHandle[0];
+    handle_t& handle = handles()[0];
     handle.allocated = false;
-    // maximum size is page_count - 1 since we're using one page for
+    handle.locked = false;
+    // maximum size is page_count - free_page since we're using those pages for
     // system operations
     handle.size = page_count;
-    handle.page = free_page; // skip by first page since that's sys_page
+    handle.page = free_page; // skip by directory pages
 }
 
 MemoryPoolIndexedHandlePage::handle_t* MemoryPoolIndexedHandlePage::get_first_unallocated_handle(
         size_t total,
         handle_opaque_t* index)
 {
-    for(int i = 0; i < header.size; i++)
+    for(size_t i = 0; i < handle_count(); i++)
     {
-        handle_t& descriptor = indexedHandle[i];
+        handle_t& descriptor = handles()[i];
 
         if(!descriptor.allocated && descriptor.is_initialized())
         {
@@ -40,5 +42,158 @@ MemoryPoolIndexedHandlePage::handle_t* MemoryPoolIndexedHandlePage::get_first_un
 }
 
 
+MemoryPoolIndexedHandlePage::handle_t* MemoryPoolIndexedHandlePage::get_unallocated_handle(
+        uint8_t minimum,
+        handle_opaque_t* index)
+{
+    for(size_t i = 0; i < handle_count(); i++)
+    {
+        handle_t& descriptor = handles()[i];
+
+        if(!descriptor.allocated && descriptor.size >= minimum && descriptor.is_initialized())
+        {
+            *index = i;
+            return &descriptor;
+        }
+    }
+
+    return NULLPTR;
+}
+
+
+void MemoryPoolIndexedHandlePage::coalesce(handle_opaque_t handle, size_t page_count)
+{
+    handle_t& freed = handles()[handle];
+    size_t next_page = freed.page + freed.size;
+
+    if(next_page < page_count)
+    {
+        handle_t* next = find_handle_by_page(next_page);
+
+        if(next != NULLPTR && !next->allocated) freed.combine(*next);
+    }
+
+    handle_t* prev = find_handle_ending_at(freed.page);
+
+    if(prev != NULLPTR && !prev->allocated) prev->combine(freed);
+}
+
+
+bool MemoryPoolIndexedHandlePage::expand(handle_opaque_t handle, uint8_t size_in_pages, size_t page_count)
+{
+    handle_t& descriptor = handles()[handle];
+
+    if(size_in_pages <= descriptor.size) return true;
+
+    size_t next_page = descriptor.page + descriptor.size;
+
+    if(next_page >= page_count) return false;
+
+    handle_t* next = find_handle_by_page(next_page);
+    uint8_t needed = size_in_pages - descriptor.size;
+
+    if(next == NULLPTR || next->allocated || next->size < needed) return false;
+
+    descriptor.size = size_in_pages;
+
+    if(next->size == needed)
+        next->set_uninitialized();
+    else
+    {
+        next->page += needed;
+        next->size -= needed;
+    }
+
+    return true;
+}
+
+
+void MemoryPoolIndexedHandlePage::shrink(handle_opaque_t handle, uint8_t size_in_pages,
+                                         size_t page_size, size_t page_count)
+{
+    handle_t& descriptor = handles()[handle];
+
+    // runs are never empty
+    if(size_in_pages == 0) size_in_pages = 1;
+
+    if(size_in_pages >= descriptor.size) return;
+
+    uint8_t tail_page = descriptor.page + size_in_pages;
+    uint8_t tail_size = descriptor.size - size_in_pages;
+    size_t next_page = descriptor.page + descriptor.size;
+    handle_t* next = next_page < page_count ? find_handle_by_page(next_page) : NULLPTR;
+
+    if(next != NULLPTR && !next->allocated)
+    {
+        // free run following us simply grows downward to take in the tail
+        next->page = tail_page;
+        next->size += tail_size;
+    }
+    else
+    {
+        handle_opaque_t index;
+        handle_t* tail = get_uninitialized_handle(handle_capacity(page_size), &index);
+
+        if(tail == NULLPTR) return;
+
+        tail->allocated = false;
+        tail->locked = false;
+        tail->page = tail_page;
+        tail->size = tail_size;
+    }
+
+    descriptor.size = size_in_pages;
+}
+
+
+bool MemoryPoolIndexedHandlePage::compact_step(uint8_t* pages, size_t page_size, size_t page_count)
+{
+    // walk runs in physical order.  Runs always tile all pages past the directory
+    size_t page = get_directory_pages();
+
+    while(page < page_count)
+    {
+        handle_t* current = find_handle_by_page(page);
+
+        ASSERT_ERROR(false, current == NULLPTR, "no handle found for page " << page);
+
+        if(current == NULLPTR) return false;
+
+        size_t next_page = page + current->size;
+
+        if(current->allocated || next_page >= page_count)
+        {
+            page = next_page;
+            continue;
+        }
+
+        handle_t* next = find_handle_by_page(next_page);
+
+        if(!next->allocated)
+        {
+            current->combine(*next);
+            return true;
+        }
+
+        if(next->locked)
+        {
+            page = next_page + next->size;
+            continue;
+        }
+
+        // slide unlocked allocation down into free run, free run then
+        // sits just after it
+        memmove(pages + page * page_size,
+                pages + next_page * page_size,
+                next->size * page_size);
+
+        next->page = page;
+        current->page = page + next->size;
+        return true;
+    }
+
+    return false;
+}
+
 
 }}
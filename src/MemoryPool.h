@@ -33,19 +33,22 @@ struct PACKED MemoryPoolDescriptor
     {
         /// Is the memory on the page allocated or free
         bool allocated : 1;
+        /// Is the memory presently locked, and therefore not relocatable
+        bool locked : 1;
         /// What page in the pool does this handle point to
         uint8_t page;
-        /// how many pages large this handle is
-        /// @name test
-        uint8_t size : 7;
+        /// how many pages large this handle is.  Full 8 bits so that one run
+        /// can span any pool up to 255 pages
+        uint8_t size;
 
         void set_uninitialized()
         {
             allocated = false;
+            locked = false;
             size = 0;
         }
 
-        bool is_initialized()
+        bool is_initialized() const
         {
             return size > 0;
         }
@@ -73,10 +76,113 @@ struct PACKED MemoryPoolDescriptor
 };
 
 // page dedicated to just managing handles
+// When header.followup is set, a DirectoryExtension follows the header and
+// the handle directory may continue into the pages directly following this
+// one.  Handles are laid out contiguously across all directory pages, so
+// handle lookup remains simple array indexing
 struct PACKED MemoryPoolHandlePage
 {
     MemoryPoolDescriptor header;
     //MemoryPoolDescriptor::CompactHandle compactHandle[];
+
+    /// Layout of the span a pool was formatted for.  Recorded just after the
+    /// DirectoryExtension by pools whose pages outlive them, so reopening with
+    /// a different geometry fails rather than misreading the span
+    struct PACKED Geometry
+    {
+        /// width of page numbers and run sizes in the directory
+        uint8_t index_size;
+        uint32_t page_size;
+        uint32_t page_count;
+
+        static Geometry make(size_t page_size, size_t page_count, size_t index_size)
+        {
+            Geometry g;
+
+            g.index_size = index_size;
+            g.page_size = page_size;
+            g.page_count = page_count;
+
+            return g;
+        }
+
+        bool operator==(const Geometry& compare_to) const
+        {
+            return index_size == compare_to.index_size &&
+                   page_size == compare_to.page_size &&
+                   page_count == compare_to.page_count;
+        }
+    };
+
+    /// Present just after header only when header.followup is set, so single
+    /// page directories of pools which don't record geometry pay nothing for it
+    struct PACKED DirectoryExtension
+    {
+        /// # of contiguous pages, inclusive of page 0, the handle directory spans
+        uint8_t pages;
+        /// tier specific handle count, for when 4 bit header.size is too narrow
+        uint8_t size;
+        /// geometry_marker() when a Geometry follows, otherwise 0
+        uint8_t format;
+    };
+
+    static CONSTEXPR uint8_t geometry_marker() { return 0xA1; }
+
+    DirectoryExtension* get_extension() const
+    {
+        return header.followup ? (DirectoryExtension*)(&header + 1) : NULLPTR;
+    }
+
+    /// # of pages the handle directory spans.  Data pages begin right after
+    uint8_t get_directory_pages() const
+    {
+        return header.followup ? get_extension()->pages : 1;
+    }
+
+    /// Geometry span was formatted with, or NULLPTR if none was recorded
+    Geometry* get_geometry() const
+    {
+        DirectoryExtension* extension = get_extension();
+
+        if(extension == NULLPTR || extension->format != geometry_marker()) return NULLPTR;
+
+        return (Geometry*)(extension + 1);
+    }
+
+    /// start of handle area, which runs contiguously across all directory pages
+    uint8_t* get_handle_area() const
+    {
+        uint8_t* area = (uint8_t*)(&header + 1);
+
+        if(!header.followup) return area;
+
+        area += sizeof(DirectoryExtension);
+
+        return get_geometry() != NULLPTR ? area + sizeof(Geometry) : area;
+    }
+
+    /// bytes available for handles (and tier specific tables) across all directory pages
+    size_t get_handle_area_size(size_t page_size) const
+    {
+        return get_directory_pages() * page_size - (get_handle_area() - (const uint8_t*)this);
+    }
+
+    /// @param geometry recorded for later verification, if not NULLPTR
+    void initialize_directory(uint8_t directory_pages, const Geometry* geometry = NULLPTR)
+    {
+        header.followup = directory_pages > 1 || geometry != NULLPTR;
+
+        if(header.followup)
+        {
+            DirectoryExtension* extension = get_extension();
+
+            extension->pages = directory_pages;
+            extension->size = 0;
+            extension->format = geometry != NULLPTR ? geometry_marker() : 0;
+
+            if(geometry != NULLPTR) *get_geometry() = *geometry;
+        }
+    }
 };
 
 
@@ -87,6 +193,12 @@ struct PACKED MemoryPoolHandlePage
 #endif
 
 
+/// One contiguous piece of source data, for scatter style writes
+struct MemorySpan
+{
+    const void* data;
+    size_t length;
+};
 
 
 }}
@@ -8,6 +8,13 @@
 #include <iterator>
 #include <algorithm>
 
+#include "../mc/mem/platform.h"
+
+#ifdef __CPP11__
+#include <atomic>
+#include <stdint.h>
+#endif
+
 namespace moducom { namespace mem { namespace experimental {
 
 // mainly useful for 8-bit CPUs which don't have to necessarily
@@ -135,6 +142,52 @@ public:
         front().next(current_front);
 
     }
+
+    /// Detaches up to n items from the front of the free list as one chain
+    /// @return number of handles written to out, less than n only if pool ran dry
+    size_t allocate_n(handle_type* out, size_t n)
+    {
+        _node_handle h = m_front;
+        size_t i = 0;
+
+        for(; i < n && h != eol(); i++)
+        {
+            out[i] = h;
+            h = items[h].next();
+        }
+
+        m_front = h;
+
+        return i;
+    }
+
+    /// Links n items to each other, then splices that chain onto the front
+    /// of the free list all at once
+    void deallocate_n(const handle_type* in, size_t n)
+    {
+        if(n == 0) return;
+
+        for(size_t i = 0; i < n - 1; i++)
+            items[in[i]].next(in[i + 1]);
+
+        items[in[n - 1]].next(m_front);
+
+        m_front = in[0];
+    }
+
+    /// Item whose value this is
+    handle_type handle_of(const T* value) const
+    {
+        return static_cast<const Node*>((const _Node*)value) - items;
+    }
+
+    /// true if p points into one of this pool's items
+    bool contains(const void* p) const
+    {
+        const uint8_t* first = (const uint8_t*)&items[0];
+
+        return (const uint8_t*)p >= first && (const uint8_t*)p < first + sizeof(Node) * N;
+    }
 };
 
 
@@ -154,21 +207,29 @@ class LinkedListPool3
 {
 public:
     typedef typename TContainer::value_type node_t;
+    typedef T value_type;
 
 private:
     typedef TContainer array_t;
-    typedef estd::intrustive_forward_list<node_t> list_t;
 
-    list_t free_nodes;
+    // head of free list, NULLPTR when pool is exhausted.  Held directly rather
+    // than as an intrustive_forward_list so batches can splice a whole chain
+    // on and off with one store
+    node_t* m_front;
     array_t raw;
 
+    static node_t* next(const node_t* node)
+    {
+        return static_cast<node_t*>(node->next());
+    }
+
 public:
     LinkedListPool3()
     {
         typename array_t::iterator i = raw.begin();
         node_t* current = &(*i);
 
-        free_nodes.push_front(*current);
+        m_front = current;
 
         while(++i != raw.end())
         {
@@ -177,13 +238,27 @@ public:
             current->next(&next);
             current = &next;
         }
+
+        current->next(NULLPTR);
+    }
+
+    /// Node whose value this is
+    static node_t* node_of(T* value)
+    {
+        // same trick as intrusive_node_pool_allocator::deallocate
+        node_t* node = NULLPTR;
+        size_t offset = (uint8_t*)&node->value - (uint8_t*)node;
+
+        return (node_t*)((uint8_t*)value - offset);
     }
 
     node_t* alloc()
     {
-        node_t& front = free_nodes.front();
-        free_nodes.pop_front();
-        return &front;
+        node_t* front = m_front;
+
+        if(front != NULLPTR) m_front = next(front);
+
+        return front;
     }
 
 
@@ -191,24 +266,238 @@ public:
     // contained in raw
     void free(node_t* node)
     {
-        free_nodes.push_front(*node);
+        node->next(m_front);
+        m_front = node;
+    }
+
+    /// Detaches up to n nodes from the front of the free list as one chain
+    /// @return number of nodes written to out, less than n only if pool ran dry
+    size_t allocate_n(node_t** out, size_t n)
+    {
+        node_t* node = m_front;
+        size_t i = 0;
+
+        for(; i < n && node != NULLPTR; i++)
+        {
+            out[i] = node;
+            node = next(node);
+        }
+
+        m_front = node;
+
+        return i;
+    }
+
+    /// Links n nodes to each other, then splices that chain onto the front
+    /// of the free list all at once
+    // NOTE: behavior is undefined if any incoming node_t is NOT
+    // contained in raw
+    void free_n(node_t* const* in, size_t n)
+    {
+        if(n == 0) return;
+
+        for(size_t i = 0; i < n - 1; i++)
+            in[i]->next(in[i + 1]);
+
+        in[n - 1]->next(m_front);
+
+        m_front = in[0];
     }
 
     size_t max_size() const { return N; }
 
+    /// true if p points into one of this pool's nodes
+    bool contains(const void* p) const
+    {
+        const uint8_t* first = (const uint8_t*)&raw[0];
+
+        return (const uint8_t*)p >= first && (const uint8_t*)p < first + sizeof(node_t) * N;
+    }
+
     // returns number of unallocated slots
     size_t available() const
     {
         size_t count = 0;
-        typename list_t::iterator i = free_nodes.begin();
 
-        for(; i != free_nodes.end(); i++) count++;
+        for(const node_t* i = m_front; i != NULLPTR; i = next(i)) count++;
 
         return count;
-        //return std::count(free_nodes.begin(), free_nodes.end());
+    }
+};
+
+
+#ifdef __CPP11__
+template <class T>
+struct ConcurrentLinkedListPool3Node
+{
+    T value;
+
+    // index of next free node.  Atomic since a popping thread may read it
+    // while another thread has already claimed and is reusing this node
+    std::atomic<uint32_t> next;
+};
+
+
+// Lock-free flavor of LinkedListPool3 for multiple producer/consumer threads.
+// Free list is a Treiber stack whose head is a node index tagged with a
+// counter bumped on every change, so a head which was popped and pushed
+// back in the meantime (ABA) is never mistaken for an unchanged one
+template <class T, size_t N>
+class ConcurrentLinkedListPool3
+{
+public:
+    typedef ConcurrentLinkedListPool3Node<T> node_t;
+    typedef T value_type;
 
-        //return std::distance(free_nodes.begin(), free_nodes.end());
+private:
+    static CONSTEXPR uint32_t eol() { return N; }
+
+    // low 32 bits node index, high 32 bits tag
+    typedef uint64_t tagged_t;
+
+    static tagged_t make_tagged(uint32_t index, uint32_t tag)
+    {
+        return ((tagged_t)tag << 32) | index;
+    }
+
+    static uint32_t get_index(tagged_t t) { return (uint32_t)t; }
+    static uint32_t get_tag(tagged_t t) { return (uint32_t)(t >> 32); }
+
+    std::atomic<tagged_t> head;
+    node_t raw[N];
+
+public:
+    ConcurrentLinkedListPool3() : head(make_tagged(0, 0))
+    {
+        for(uint32_t i = 0; i < N; i++)
+            raw[i].next.store(i + 1, std::memory_order_relaxed);
+    }
+
+    /// Node whose value this is
+    static node_t* node_of(T* value)
+    {
+        return (node_t*)((uint8_t*)value - offsetof(node_t, value));
+    }
+
+    /// @return free node, or nullptr if none remain
+    node_t* alloc()
+    {
+        tagged_t current = head.load(std::memory_order_acquire);
+
+        for(;;)
+        {
+            uint32_t index = get_index(current);
+
+            if(index == eol()) return NULLPTR;
+
+            uint32_t next = raw[index].next.load(std::memory_order_relaxed);
+            tagged_t replacement = make_tagged(next, get_tag(current) + 1);
+
+            // on failure current is refreshed, and we try again
+            if(head.compare_exchange_weak(current, replacement,
+                                          std::memory_order_acquire,
+                                          std::memory_order_acquire))
+                return &raw[index];
+        }
+    }
+
+    // NOTE: behavior is undefined if incoming node_t is NOT
+    // contained in raw
+    void free(node_t* node)
+    {
+        uint32_t index = node - raw;
+        tagged_t current = head.load(std::memory_order_relaxed);
+
+        for(;;)
+        {
+            node->next.store(get_index(current), std::memory_order_relaxed);
+
+            tagged_t replacement = make_tagged(index, get_tag(current) + 1);
+
+            if(head.compare_exchange_weak(current, replacement,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    /// Pops up to n nodes with a single exchange of head
+    /// @return number of nodes written to out, less than n only if pool ran dry
+    size_t allocate_n(node_t** out, size_t n)
+    {
+        tagged_t current = head.load(std::memory_order_acquire);
+
+        for(;;)
+        {
+            uint32_t index = get_index(current);
+            size_t count = 0;
+
+            // links may be stale if another thread gets in first, but then
+            // head has changed too and the exchange below fails
+            for(; count < n && index != eol(); count++)
+            {
+                out[count] = &raw[index];
+                index = raw[index].next.load(std::memory_order_relaxed);
+            }
+
+            if(count == 0) return 0;
+
+            tagged_t replacement = make_tagged(index, get_tag(current) + 1);
+
+            if(head.compare_exchange_weak(current, replacement,
+                                          std::memory_order_acquire,
+                                          std::memory_order_acquire))
+                return count;
+        }
+    }
+
+    /// Links n nodes to each other, then pushes that chain with a single
+    /// exchange of head
+    // NOTE: behavior is undefined if any incoming node_t is NOT
+    // contained in raw
+    void free_n(node_t* const* in, size_t n)
+    {
+        if(n == 0) return;
+
+        for(size_t i = 0; i < n - 1; i++)
+            in[i]->next.store(in[i + 1] - raw, std::memory_order_relaxed);
+
+        uint32_t first = in[0] - raw;
+        tagged_t current = head.load(std::memory_order_relaxed);
+
+        for(;;)
+        {
+            in[n - 1]->next.store(get_index(current), std::memory_order_relaxed);
+
+            tagged_t replacement = make_tagged(first, get_tag(current) + 1);
+
+            if(head.compare_exchange_weak(current, replacement,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    size_t max_size() const { return N; }
+
+    /// true if p points into one of this pool's nodes
+    bool contains(const void* p) const
+    {
+        return (const uint8_t*)p >= (const uint8_t*)raw && (const uint8_t*)p < (const uint8_t*)(raw + N);
+    }
+
+    // returns number of unallocated slots.  Only exact when no other thread
+    // is using the pool
+    size_t available() const
+    {
+        size_t count = 0;
+        uint32_t i = get_index(head.load(std::memory_order_acquire));
+
+        for(; i != eol(); i = raw[i].next.load(std::memory_order_relaxed)) count++;
+
+        return count;
     }
 };
+#endif
 
 }}}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mem/platform.h"
+
+// Scans 128 bits at a time for a non-full word when looking for clear bits
+#if defined(__SSE2__) && !defined(FEATURE_MC_MEM_BITMAP_NO_SIMD)
+#define FEATURE_MC_MEM_BITMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace moducom { namespace mem {
+
+// Word-at-a-time helpers over a packed array of bits.  Bit n lives in
+// words[n / word_bits] at position n % word_bits.  Bits past the end of
+// the bitmap in the last word are always kept clear
+struct BitmapBase
+{
+    typedef unsigned long word_type;
+
+    enum
+    {
+        word_bits = sizeof(word_type) * 8
+    };
+
+    static size_t word_count(size_t bits)
+    {
+        return (bits + word_bits - 1) / word_bits;
+    }
+
+    static size_t popcount(word_type w)
+    {
+#ifdef __GNUC__
+        return __builtin_popcountl(w);
+#else
+        size_t c = 0;
+
+        // clears lowest set bit each pass
+        for(; w; c++) w &= w - 1;
+
+        return c;
+#endif
+    }
+
+    // count trailing zeros.  w must not be 0
+    static size_t ctz(word_type w)
+    {
+#ifdef __GNUC__
+        return __builtin_ctzl(w);
+#else
+        size_t c = 0;
+
+        for(; !(w & 1); c++) w >>= 1;
+
+        return c;
+#endif
+    }
+
+    static bool test(const word_type* words, size_t n)
+    {
+        return (words[n / word_bits] >> (n % word_bits)) & 1;
+    }
+
+    static void set(word_type* words, size_t n)
+    {
+        words[n / word_bits] |= (word_type)1 << (n % word_bits);
+    }
+
+    static void reset(word_type* words, size_t n)
+    {
+        words[n / word_bits] &= ~((word_type)1 << (n % word_bits));
+    }
+
+    // returns number of set bits
+    static size_t count(const word_type* words, size_t bits)
+    {
+        const size_t n = word_count(bits);
+        size_t c = 0;
+
+        for(size_t i = 0; i < n; i++)
+            c += popcount(words[i]);
+
+        return c;
+    }
+
+    // returns index of first set bit, or 'bits' if none are set
+    static size_t find_first_set(const word_type* words, size_t bits)
+    {
+        const size_t n = word_count(bits);
+
+        for(size_t i = 0; i < n; i++)
+        {
+            if(words[i] != 0)
+                return i * word_bits + ctz(words[i]);
+        }
+
+        return bits;
+    }
+
+    // returns index of first clear bit, or 'bits' if all are set
+    static size_t find_first_clear(const word_type* words, size_t bits)
+    {
+        const size_t n = word_count(bits);
+        size_t i = 0;
+
+#ifdef FEATURE_MC_MEM_BITMAP_SSE2
+        const size_t words_per_vector = sizeof(__m128i) / sizeof(word_type);
+        const __m128i full = _mm_set1_epi8((char)0xFF);
+
+        // skip over completely occupied stretches a vector at a time
+        for(; i + words_per_vector <= n; i += words_per_vector)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(words + i));
+
+            if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, full)) != 0xFFFF) break;
+        }
+#endif
+
+        for(; i < n; i++)
+        {
+            word_type inverted = ~words[i];
+
+            if(inverted != 0)
+            {
+                size_t found = i * word_bits + ctz(inverted);
+
+                // trailing padding bits read as clear, so filter those out
+                return found < bits ? found : bits;
+            }
+        }
+
+        return bits;
+    }
+};
+
+
+namespace layer1 {
+
+// Bitmap with inline word storage
+template <size_t bits>
+class Bitmap : public BitmapBase
+{
+    word_type words[(bits + word_bits - 1) / word_bits];
+
+public:
+    Bitmap() { clear(); }
+
+    void clear() { memset(words, 0, sizeof(words)); }
+
+    bool test(size_t n) const { return BitmapBase::test(words, n); }
+
+    void set(size_t n) { BitmapBase::set(words, n); }
+
+    void reset(size_t n) { BitmapBase::reset(words, n); }
+
+    size_t count() const { return BitmapBase::count(words, bits); }
+
+    size_t find_first_set() const { return BitmapBase::find_first_set(words, bits); }
+
+    size_t find_first_clear() const { return BitmapBase::find_first_clear(words, bits); }
+
+    size_t size() const { return bits; }
+
+    word_type* data() { return words; }
+
+    const word_type* data() const { return words; }
+};
+
+}
+
+namespace layer3 {
+
+// Bitmap over externally owned word storage
+class Bitmap : public BitmapBase
+{
+    word_type* words;
+    size_t bits;
+
+public:
+    Bitmap(word_type* words, size_t bits) :
+        words(words),
+        bits(bits) {}
+
+    void clear() { memset(words, 0, word_count(bits) * sizeof(word_type)); }
+
+    bool test(size_t n) const { return BitmapBase::test(words, n); }
+
+    void set(size_t n) { BitmapBase::set(words, n); }
+
+    void reset(size_t n) { BitmapBase::reset(words, n); }
+
+    size_t count() const { return BitmapBase::count(words, bits); }
+
+    size_t find_first_set() const { return BitmapBase::find_first_set(words, bits); }
+
+    size_t find_first_clear() const { return BitmapBase::find_first_clear(words, bits); }
+
+    size_t size() const { return bits; }
+
+    word_type* data() const { return words; }
+};
+
+}
+
+}}
@@ -24,7 +24,8 @@
 #if __cplusplus >= 201103L
 #define __CPP11__
 #endif
-#if __cplusplus >= 201703L
+// strncpy_s is Annex K, which C libraries besides MSVC's seldom provide
+#if __cplusplus >= 201703L && defined(__STDC_LIB_EXT1__)
 #define FEATURE_CPP_STRNCPY_S
 #endif
 
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "mem/platform.h"
+
+#include <stddef.h>
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define FEATURE_MC_MEM_MMAP
+#endif
+
+#ifdef FEATURE_MC_MEM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace moducom { namespace dynamic {
+
+#ifdef FEATURE_MC_MEM_MMAP
+// File mapped MAP_SHARED, typically as backing span for an ExternalMemoryPool.
+// Writes land in the file (and in any other process mapping it), so pool
+// contents survive restarts
+class MappedFile
+{
+    void* m_data;
+    size_t m_size;
+    bool m_created;
+
+    // noncopyable
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile() :
+        m_data(NULLPTR),
+        m_size(0),
+        m_created(false) {}
+
+    ~MappedFile() { close(); }
+
+    /// Maps size bytes of file at path, creating it (zero filled) if necessary
+    /// @param read_only map PROT_READ only.  Pools over such a mapping may only
+    /// be read via get_data(), since even lock() writes to the page header
+    /// @return false if file couldn't be opened, sized or mapped
+    bool open(const char* path, size_t size, bool read_only = false)
+    {
+        close();
+
+        int fd = ::open(path, read_only ? O_RDONLY : (O_RDWR | O_CREAT), 0644);
+
+        if(fd < 0) return false;
+
+        struct stat st;
+
+        if(fstat(fd, &st) != 0 ||
+           ((size_t)st.st_size < size && (read_only || ftruncate(fd, size) != 0)))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        // a file which had to be grown holds no (complete) pool yet
+        m_created = (size_t)st.st_size < size;
+
+        void* data = mmap(NULLPTR, size, read_only ? PROT_READ : (PROT_READ | PROT_WRITE),
+                          MAP_SHARED, fd, 0);
+
+        // mapping keeps its own reference to file
+        ::close(fd);
+
+        if(data == MAP_FAILED) return false;
+
+        m_data = data;
+        m_size = size;
+
+        return true;
+    }
+
+    void close()
+    {
+        if(m_data == NULLPTR) return;
+
+        munmap(m_data, m_size);
+
+        m_data = NULLPTR;
+        m_size = 0;
+    }
+
+    /// Flushes dirty pages to file
+    bool sync()
+    {
+        return m_data != NULLPTR && msync(m_data, m_size, MS_SYNC) == 0;
+    }
+
+    void* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    /// true if open() had to create or extend file, so contents need initializing
+    bool created() const { return m_created; }
+};
+#endif
+
+}}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "mem/platform.h"
+#include "memory-chunk.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define FEATURE_MC_MEM_PAGES_MMAP
+#endif
+
+// huge pages and NUMA policy are Linux only.  Define FEATURE_MC_MEM_PAGES_NO_NUMA
+// to leave out mbind/getcpu syscalls altogether
+#if defined(FEATURE_MC_MEM_PAGES_MMAP) && defined(__linux__)
+#define FEATURE_MC_MEM_PAGES_LINUX
+#endif
+
+#ifdef FEATURE_MC_MEM_PAGES_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef FEATURE_MC_MEM_PAGES_LINUX
+#include <stdio.h>
+#include <sys/syscall.h>
+#ifndef FEATURE_MC_MEM_PAGES_NO_NUMA
+#include <linux/mempolicy.h>
+#endif
+#endif
+
+namespace moducom { namespace dynamic {
+
+// Backing memory for pools, obtained straight from the OS rather than the
+// heap, optionally on huge pages and bound to one NUMA node.  Every feature
+// is a request: whatever the platform can't do is skipped, and granted()
+// reports what actually took effect.  Without mmap this is plain malloc
+//
+// Typical use:
+//
+//   PageRegion region;
+//   region.allocate(pool_t::span_size(), PageRegion::TransparentHuge | PageRegion::BindNode, node);
+//   pool_t pool(region.data());            // ExternalMemoryPool, RuntimeMemoryPool
+//   ObjStack stack(region.chunk());
+//   PoolBase<T, n>* items = region.construct<PoolBase<T, n> >();
+class PageRegion
+{
+public:
+    enum Flags
+    {
+        /// advise kernel to back region with transparent huge pages
+        TransparentHuge = 0x01,
+        /// map from the hugetlbfs reserve (vm.nr_hugepages).  Falls back to
+        /// regular pages when the reserve is empty
+        ExplicitHuge = 0x02,
+        /// place region's pages on node given to allocate()
+        BindNode = 0x04,
+        /// with BindNode, fail page faults rather than spill onto other nodes
+        StrictNode = 0x08,
+        /// touch every page up front, so faults (and placement) happen now
+        Populate = 0x10
+    };
+
+    static CONSTEXPR int any_node() { return -1; }
+
+private:
+    uint8_t* m_data;
+    size_t m_size;
+    // bytes actually mapped, rounded up to page (or huge page) size
+    size_t m_mapped;
+    unsigned m_granted;
+
+    // noncopyable
+    PageRegion(const PageRegion&);
+    PageRegion& operator=(const PageRegion&);
+
+    static size_t round_up(size_t size, size_t granularity)
+    {
+        return (size + granularity - 1) / granularity * granularity;
+    }
+
+#ifdef FEATURE_MC_MEM_PAGES_MMAP
+    void* map(size_t size, bool huge)
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#if defined(FEATURE_MC_MEM_PAGES_LINUX) && defined(MAP_HUGETLB)
+        if(huge) flags |= MAP_HUGETLB;
+#else
+        if(huge) return MAP_FAILED;
+#endif
+
+        return mmap(NULLPTR, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    }
+#endif
+
+#if defined(FEATURE_MC_MEM_PAGES_LINUX) && !defined(FEATURE_MC_MEM_PAGES_NO_NUMA)
+    // must happen before pages are first touched to have any effect
+    bool bind(int node, bool strict)
+    {
+        unsigned long mask;
+
+        if(node < 0 || node >= (int)sizeof(mask) * 8) return false;
+
+        mask = 1UL << node;
+
+        // kernel expects one more than the # of mask bits
+        return syscall(SYS_mbind, m_data, m_mapped, strict ? MPOL_BIND : MPOL_PREFERRED,
+                       &mask, sizeof(mask) * 8 + 1, 0) == 0;
+    }
+#endif
+
+public:
+    PageRegion() :
+        m_data(NULLPTR),
+        m_size(0),
+        m_mapped(0),
+        m_granted(0) {}
+
+    ~PageRegion() { release(); }
+
+    /// default hugetlbfs page size, which is what MAP_HUGETLB maps, or 0 if it
+    /// can't be determined.  May differ from the transparent huge page size
+    static size_t huge_page_size()
+    {
+#ifdef FEATURE_MC_MEM_PAGES_LINUX
+        FILE* f = fopen("/proc/meminfo", "r");
+        unsigned long size_kb = 0;
+
+        if(f != NULLPTR)
+        {
+            char line[128];
+
+            while(fgets(line, sizeof(line), f) != NULLPTR)
+                if(sscanf(line, "Hugepagesize: %lu kB", &size_kb) == 1) break;
+
+            fclose(f);
+        }
+
+        return size_kb * 1024;
+#else
+        return 0;
+#endif
+    }
+
+    static size_t base_page_size()
+    {
+#ifdef FEATURE_MC_MEM_PAGES_MMAP
+        return (size_t)sysconf(_SC_PAGESIZE);
+#else
+        return 1;
+#endif
+    }
+
+    /// NUMA node calling thread is presently running on, or any_node() if unknown.
+    /// Lets per-core shards pick their node at startup
+    static int current_node()
+    {
+#if defined(FEATURE_MC_MEM_PAGES_LINUX) && !defined(FEATURE_MC_MEM_PAGES_NO_NUMA) && defined(SYS_getcpu)
+        unsigned cpu, node;
+
+        if(syscall(SYS_getcpu, &cpu, &node, NULLPTR) == 0) return (int)node;
+#endif
+        return any_node();
+    }
+
+    /// Obtains size bytes of zero filled memory, releasing any held previously
+    /// @param flags requested Flags.  Those which can't be honored are dropped
+    /// @param node NUMA node for BindNode
+    /// @return false only if no memory could be had at all
+    bool allocate(size_t size, unsigned flags = 0, int node = any_node())
+    {
+        release();
+
+        m_size = size;
+
+#ifdef FEATURE_MC_MEM_PAGES_MMAP
+        void* data = MAP_FAILED;
+
+        if(flags & ExplicitHuge)
+        {
+            size_t huge_size = huge_page_size();
+
+            if(huge_size != 0)
+            {
+                m_mapped = round_up(size, huge_size);
+                data = map(m_mapped, true);
+            }
+
+            if(data != MAP_FAILED) m_granted |= ExplicitHuge;
+        }
+
+        if(data == MAP_FAILED)
+        {
+            m_mapped = round_up(size, base_page_size());
+            data = map(m_mapped, false);
+        }
+
+        if(data == MAP_FAILED)
+        {
+            m_size = m_mapped = 0;
+            return false;
+        }
+
+        m_data = (uint8_t*)data;
+
+#if defined(FEATURE_MC_MEM_PAGES_LINUX) && defined(MADV_HUGEPAGE)
+        if((flags & TransparentHuge) && !(m_granted & ExplicitHuge) &&
+           madvise(m_data, m_mapped, MADV_HUGEPAGE) == 0)
+            m_granted |= TransparentHuge;
+#endif
+
+#if defined(FEATURE_MC_MEM_PAGES_LINUX) && !defined(FEATURE_MC_MEM_PAGES_NO_NUMA)
+        if((flags & BindNode) && bind(node, flags & StrictNode))
+            m_granted |= BindNode | (flags & StrictNode);
+#endif
+
+        if(flags & Populate)
+        {
+            // anonymous pages are already zero, writing one byte per page faults it in
+            const size_t step = base_page_size();
+
+            for(size_t i = 0; i < m_mapped; i += step)
+                ((volatile uint8_t*)m_data)[i] = 0;
+
+            m_granted |= Populate;
+        }
+#else
+        m_data = (uint8_t*)calloc(1, size);
+        m_mapped = size;
+
+        if(m_data == NULLPTR)
+        {
+            m_size = m_mapped = 0;
+            return false;
+        }
+
+        (void)flags;
+        (void)node;
+#endif
+
+        return true;
+    }
+
+    void release()
+    {
+        if(m_data == NULLPTR) return;
+
+#ifdef FEATURE_MC_MEM_PAGES_MMAP
+        munmap(m_data, m_mapped);
+#else
+        ::free(m_data);
+#endif
+
+        m_data = NULLPTR;
+        m_size = m_mapped = 0;
+        m_granted = 0;
+    }
+
+    uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    /// Flags honored by the last allocate()
+    unsigned granted() const { return m_granted; }
+
+    /// Region as a chunk, i.e. for ObjStack
+    pipeline::MemoryChunk chunk() const
+    {
+        return pipeline::MemoryChunk(m_data, m_size);
+    }
+
+    /// Default constructs a T, such as a PoolBase or MemoryPool, at start of region.
+    /// Caller runs ~T() before region is released
+    /// @return NULLPTR if region is too small
+    template <class T>
+    T* construct()
+    {
+        if(m_data == NULLPTR || m_size < sizeof(T)) return NULLPTR;
+
+        return new (m_data) T();
+    }
+};
+
+}}
@@ -9,6 +9,7 @@
 
 #include <stdlib.h>
 #include "array-helper.h"
+#include "bitmap.h"
 #include <estd/forward_list.h>
 #include "mem/platform.h"
 
@@ -30,6 +31,11 @@ struct DefaultPoolItemTrait
         return !item.is_active();
     }
 
+    static void allocate(T& item)
+    {
+        new (&item) T();
+    }
+
     template <class TArg1>
     static void allocate(T& item, TArg1 arg1)
     {
@@ -64,6 +70,12 @@ struct ExplicitPoolItemTrait
     }
 
 
+    static void allocate(T& item)
+    {
+        item.allocate();
+    }
+
+
     template <class TArg1>
     static void allocate(T& item, TArg1 arg1)
     {
@@ -177,6 +189,57 @@ public:
 };
 
 
+// OutOfBandPool variety which consults a packed occupancy bitmap rather than
+// the items themselves.  Allocation and count() scan the bitmap a word at a
+// time and never touch item storage
+template <class T, class TTraits = DefaultPoolItemTrait<T > >
+class OutOfBandBitmapPool
+{
+    typedef TTraits traits_t;
+    typedef mem::layer3::Bitmap bitmap_t;
+
+    T* items;
+    bitmap_t occupied;
+
+public:
+    typedef bitmap_t::word_type word_type;
+
+    // NOTE: words must already reflect occupancy of items
+    OutOfBandBitmapPool(T* items, word_type* words, size_t max_count) :
+        items(items),
+        occupied(words, max_count) {}
+
+    template <class TArg1>
+    T* allocate(TArg1 arg1)
+    {
+        size_t i = occupied.find_first_clear();
+
+        if(i == occupied.size()) return NULLPTR;
+
+        occupied.set(i);
+        traits_t::allocate(items[i], arg1);
+
+        return &items[i];
+    }
+
+    void free(T* item)
+    {
+        size_t index = item - items;
+
+        ASSERT_ERROR(true, index < occupied.size(), "item not from this pool");
+
+        traits_t::free(*item);
+        occupied.reset(index);
+    }
+
+    // returns number of allocated items
+    size_t count() const { return occupied.count(); }
+
+    // returns number of free slots
+    size_t free() const { return occupied.size() - count(); }
+};
+
+
 template <class T, size_t max_count, class TTraits = DefaultPoolItemTrait<T > >
 class PoolBase : PoolBaseBase<T, TTraits>
 {
@@ -269,6 +332,38 @@ public:
         base_t::free(items, max_count, item);
     }
 
+    /// Allocates up to n items in a single pass over the pool
+    /// @return number of items written to out, less than n only if pool ran out
+    size_t allocate_n(T** out, size_t n)
+    {
+        size_t allocated = 0;
+
+        for(size_t i = 0; i < max_count && allocated < n; i++)
+        {
+            T& candidate = items[i];
+
+            if(traits_t::is_free(candidate))
+            {
+                traits_t::allocate(candidate);
+                out[allocated++] = &candidate;
+            }
+        }
+
+        return allocated;
+    }
+
+    // NOTE: unlike free(T*), items are located by address rather than searched
+    // for, so behavior is undefined if any item was not allocated from this pool
+    void free_n(T* const* in, size_t n)
+    {
+        for(size_t i = 0; i < n; i++)
+        {
+            ASSERT_ERROR(true, (size_t)(in[i] - items) < max_count, "item not from this pool");
+
+            traits_t::free(*in[i]);
+        }
+    }
+
     // returns number of allocated items
     size_t count() const
     {
@@ -293,6 +388,226 @@ public:
     operator oobp_t() const { return out_of_band(); }
 };
 
+
+// Picks the smallest unsigned type able to index max_count slots, keeping
+// the top value free as an 'end of list' marker
+template <size_t max_count,
+          bool fits8 = (max_count < 0xFF),
+          bool fits16 = (max_count < 0xFFFF)>
+struct PoolIndexType
+{
+    typedef uint32_t type;
+};
+
+
+template <size_t max_count, bool fits16>
+struct PoolIndexType<max_count, true, fits16>
+{
+    typedef uint8_t type;
+};
+
+
+template <size_t max_count>
+struct PoolIndexType<max_count, false, true>
+{
+    typedef uint16_t type;
+};
+
+
+// PoolBase variety which tracks free slots with a singly linked free list, so
+// allocate and free are O(1) rather than a linear is_free() scan.  Links
+// live in a side array rather than inside T, since traits rely on a free
+// item still reporting its own (inactive) state
+template <class T, size_t max_count, class TTraits = DefaultPoolItemTrait<T > >
+class FreeListPool
+{
+    typedef TTraits traits_t;
+    typedef typename PoolIndexType<max_count>::type index_t;
+
+    static CONSTEXPR index_t eol() { return (index_t)-1; }
+
+    // pool items themselves
+    T items[max_count];
+
+    // next free slot, only meaningful for slots presently on the free list
+    index_t next_free[max_count];
+
+    // head of free list, eol() when pool is exhausted
+    index_t m_front;
+
+    // number of allocated items
+    index_t m_count;
+
+    // detach front of free list, or NULLPTR if pool is exhausted
+    T* pop_front()
+    {
+        if(m_front == eol()) return NULLPTR;
+
+        T* candidate = &items[m_front];
+
+        m_front = next_free[m_front];
+        m_count++;
+
+        return candidate;
+    }
+
+public:
+    FreeListPool() :
+        m_front(0),
+        m_count(0)
+    {
+        for(size_t i = 0; i < max_count; i++)
+        {
+            traits_t::initialize(items[i]);
+            next_free[i] = i + 1;
+        }
+
+        next_free[max_count - 1] = eol();
+    }
+
+    template <class TArg1>
+    T* allocate(TArg1 arg1)
+    {
+        T* candidate = pop_front();
+
+        if(candidate != NULLPTR)
+            traits_t::allocate(*candidate, arg1);
+
+        return candidate;
+    }
+
+    T* allocate()
+    {
+        T* candidate = pop_front();
+
+        if(candidate != NULLPTR)
+            traits_t::allocate(*candidate);
+
+        return candidate;
+    }
+
+    // NOTE: behavior is undefined if item was not allocated from this pool
+    void free(T* item)
+    {
+        size_t index = item - items;
+
+        ASSERT_ERROR(true, index < max_count, "item not from this pool");
+
+        traits_t::free(*item);
+
+        next_free[index] = m_front;
+        m_front = index;
+        m_count--;
+    }
+
+    // returns number of allocated items
+    size_t count() const { return m_count; }
+
+    // returns number of free slots
+    size_t free() const { return max_count - m_count; }
+
+    bool is_full() const { return m_front == eol(); }
+
+    typedef OutOfBandPool<T, traits_t> oobp_t;
+
+    oobp_t out_of_band() const
+    {
+        oobp_t oobp(items, max_count);
+        return oobp;
+    }
+
+    operator oobp_t() const { return out_of_band(); }
+};
+
+
+// PoolBase variety which keeps a packed occupancy bit per slot.  Allocation,
+// count() and first free lookups operate a word at a time on the bitmap
+// so that pool statistics never pull item storage through cache
+template <class T, size_t max_count, class TTraits = DefaultPoolItemTrait<T > >
+class BitmapPool
+{
+    typedef TTraits traits_t;
+
+    // pool items themselves
+    T items[max_count];
+
+    // one bit per item, set = allocated
+    mem::layer1::Bitmap<max_count> occupied;
+
+    // claim first free slot, or NULLPTR if pool is exhausted
+    T* claim()
+    {
+        size_t i = occupied.find_first_clear();
+
+        if(i == max_count) return NULLPTR;
+
+        occupied.set(i);
+
+        return &items[i];
+    }
+
+public:
+    BitmapPool()
+    {
+        for(size_t i = 0; i < max_count; i++)
+            traits_t::initialize(items[i]);
+    }
+
+    template <class TArg1>
+    T* allocate(TArg1 arg1)
+    {
+        T* candidate = claim();
+
+        if(candidate != NULLPTR)
+            traits_t::allocate(*candidate, arg1);
+
+        return candidate;
+    }
+
+    T* allocate()
+    {
+        T* candidate = claim();
+
+        if(candidate != NULLPTR)
+            traits_t::allocate(*candidate);
+
+        return candidate;
+    }
+
+    // NOTE: behavior is undefined if item was not allocated from this pool
+    void free(T* item)
+    {
+        size_t index = item - items;
+
+        ASSERT_ERROR(true, index < max_count, "item not from this pool");
+
+        traits_t::free(*item);
+        occupied.reset(index);
+    }
+
+    bool is_allocated(const T* item) const
+    {
+        return occupied.test(item - items);
+    }
+
+    // returns number of allocated items
+    size_t count() const { return occupied.count(); }
+
+    // returns number of free slots
+    size_t free() const { return max_count - count(); }
+
+    typedef OutOfBandBitmapPool<T, traits_t> oobp_t;
+
+    // NOTE: returned pool shares occupancy bitmap with this one
+    oobp_t out_of_band()
+    {
+        oobp_t oobp(items, occupied.data(), max_count);
+        return oobp;
+    }
+
+    operator oobp_t() { return out_of_band(); }
+};
+
 }
 
 namespace mem {
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "mem/platform.h"
+#include "memory.h"
+#include "objstack.h"
+#include "../exp/llpool.h"
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#define FEATURE_MC_MEM_PMR
+#endif
+#endif
+
+#ifdef FEATURE_MC_MEM_PMR
+#include <memory_resource>
+#include <new>
+#include <string.h>
+
+namespace moducom { namespace dynamic {
+
+namespace internal {
+
+inline void* resource_exhausted()
+{
+#if __cpp_exceptions
+    throw std::bad_alloc();
+#else
+    return NULLPTR;
+#endif
+}
+
+}
+
+
+// ObjStack (or SegmentedObjStack) as a monotonic resource, much like
+// std::pmr::monotonic_buffer_resource.  deallocate() is a no-op, memory comes
+// back when the stack is rewound - i.e. by an ObjStack::scope around the
+// containers using it
+template <class TStack = ObjStack>
+class ObjStackResource : public std::pmr::memory_resource
+{
+    TStack& stack;
+
+public:
+    ObjStackResource(TStack& stack) : stack(stack) {}
+
+    TStack& get_stack() const { return stack; }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        void* p = stack.alloc(bytes, alignment);
+
+        return p != NULLPTR ? p : internal::resource_exhausted();
+    }
+
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+
+// How PoolResource draws value sized storage from TPool.  This default suits
+// node pools, i.e. LinkedListPool3 and ConcurrentLinkedListPool3
+template <class TPool>
+struct PoolResourceTraits
+{
+    typedef typename TPool::value_type value_type;
+
+    /// @return NULLPTR if pool is dry
+    static value_type* allocate(TPool& pool)
+    {
+        typename TPool::node_t* node = pool.alloc();
+
+        return node != NULLPTR ? &node->value : NULLPTR;
+    }
+
+    static void deallocate(TPool& pool, value_type* p)
+    {
+        pool.free(TPool::node_of(p));
+    }
+
+    static bool contains(const TPool& pool, const void* p) { return pool.contains(p); }
+};
+
+
+// LinkedListPool2 deals in item handles rather than nodes
+template <class T, size_t N>
+struct PoolResourceTraits<mem::experimental::LinkedListPool2<T, N> >
+{
+    typedef mem::experimental::LinkedListPool2<T, N> pool_t;
+    typedef T value_type;
+
+    static value_type* allocate(pool_t& pool)
+    {
+        if(pool.is_full()) return NULLPTR;
+
+        return &pool.lock(pool.allocate(1));
+    }
+
+    static void deallocate(pool_t& pool, value_type* p)
+    {
+        pool.deallocate(pool.handle_of(p), 1);
+    }
+
+    static bool contains(const pool_t& pool, const void* p) { return pool.contains(p); }
+};
+
+
+// Fixed size pool, such as LinkedListPool2, LinkedListPool3 or
+// ConcurrentLinkedListPool3, as an unsynchronized pool resource.  TTraits
+// adapts other pools.  Requests which fit in a node's value
+// come from the pool.  Larger or more strictly aligned requests, or any once
+// the pool runs dry, go to upstream.  Chaining resources smallest node first
+// gives size classes:
+//
+//   PoolResource<pool64_t> r64(pool64);                        // upstream: new/delete
+//   PoolResource<pool16_t> r16(pool16, &r64);
+template <class TPool, class TTraits = PoolResourceTraits<TPool> >
+class PoolResource : public std::pmr::memory_resource
+{
+    typedef TTraits traits_t;
+    typedef typename traits_t::value_type value_type;
+
+    TPool& pool;
+    std::pmr::memory_resource* const upstream;
+
+public:
+    PoolResource(TPool& pool, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) :
+        pool(pool),
+        upstream(upstream) {}
+
+    TPool& get_pool() const { return pool; }
+    std::pmr::memory_resource* upstream_resource() const { return upstream; }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if(bytes <= sizeof(value_type))
+        {
+            value_type* p = traits_t::allocate(pool);
+
+            if(p != NULLPTR)
+            {
+                if(((uintptr_t)p & (alignment - 1)) == 0) return p;
+
+                traits_t::deallocate(pool, p);
+            }
+        }
+
+        return upstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        if(traits_t::contains(pool, p))
+            traits_t::deallocate(pool, (value_type*)p);
+        else
+            upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+
+// Handle based IMemory, such as a MemoryPool, as a memory resource.  Each
+// allocation is locked for as long as it lives, since containers hold raw
+// pointers, and carries its handle just ahead of the pointer handed out.
+// NOTE: locked runs are never moved by compaction, so a MemoryPool serving
+// long lived containers fragments as any heap would
+class IMemoryResource : public std::pmr::memory_resource
+{
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+
+    IMemory& memory;
+
+public:
+    IMemoryResource(IMemory& memory) : memory(memory) {}
+
+    IMemory& get_memory() const { return memory; }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        // room for handle, plus worst case padding since IMemory guarantees no alignment
+        handle_opaque_t handle = memory.allocate(bytes + sizeof(handle_opaque_t) + alignment - 1);
+
+        if(handle == IMemory::invalid_handle) return internal::resource_exhausted();
+
+        uintptr_t base = (uintptr_t)memory.lock(handle) + sizeof(handle_opaque_t);
+        uint8_t* p = (uint8_t*)((base + alignment - 1) & ~(uintptr_t)(alignment - 1));
+
+        // alignment may be less than handle's own
+        memcpy(p - sizeof(handle_opaque_t), &handle, sizeof(handle_opaque_t));
+
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t, size_t) override
+    {
+        handle_opaque_t handle;
+
+        memcpy(&handle, (uint8_t*)p - sizeof(handle_opaque_t), sizeof(handle_opaque_t));
+
+        memory.unlock(handle);
+        memory.free(handle);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        const IMemoryResource* o = dynamic_cast<const IMemoryResource*>(&other);
+
+        return o != NULLPTR && &o->memory == &memory;
+    }
+};
+
+}}
+
+#endif
@@ -0,0 +1,348 @@
+#pragma once
+
+#include "mem/platform.h"
+#include "memory.h"
+
+#ifdef __CPP11__
+#include <atomic>
+#include <mutex>
+#endif
+
+namespace moducom { namespace dynamic {
+
+#ifdef __CPP11__
+
+// Thread-safe IMemory front end spreading allocations over several underlying,
+// unsynchronized IMemory shards.  Each thread is homed on one shard and keeps
+// a small cache of freed blocks per size class, so the shard's mutex is only
+// taken on a cache miss or when the cache overflows
+//
+// Handles carry their shard # in the top shard_bits and their size class in
+// the class_bits just below, so free/lock from any thread reach the right
+// shard.  Underlying handles must fit in the remaining low bits, which
+// MemoryPool handles always do
+//
+// Frees only go to the cache while their shard has no locks outstanding, so
+// a free of a locked handle always reaches its shard to be refused
+template <uint8_t shard_bits = 3, size_t cache_depth = 8, size_t cache_slots = 16>
+class ShardedMemory : public IMemory
+{
+public:
+    enum
+    {
+        max_shards = 1 << shard_bits,
+        class_bits = 3,
+        // class 0 means uncached, 1-7 are 16, 32 .. 1024 bytes
+        class_count = (1 << class_bits) - 1,
+        min_class_size = 16,
+
+        shard_shift = sizeof(handle_opaque_t) * 8 - shard_bits,
+        class_shift = shard_shift - class_bits
+    };
+
+    static handle_opaque_t inner_mask()
+    {
+        return ((handle_opaque_t)1 << class_shift) - 1;
+    }
+
+private:
+    struct Shard
+    {
+        IMemory* memory;
+        std::mutex mutex;
+        // successful lock() calls not yet matched by unlock()
+        std::atomic<size_t> locks;
+    };
+
+    // freed blocks still allocated within their shard, ready for reuse
+    struct CacheSlot
+    {
+        std::atomic_flag busy;
+        uint8_t count[class_count];
+        handle_opaque_t handles[class_count][cache_depth];
+    };
+
+    Shard shards[max_shards];
+    CacheSlot cache[cache_slots];
+    uint8_t shard_count;
+
+    static size_t class_size(uint8_t size_class)
+    {
+        return (size_t)min_class_size << (size_class - 1);
+    }
+
+    static uint8_t get_size_class(size_t size)
+    {
+        for(uint8_t c = 1; c <= class_count; c++)
+            if(size <= class_size(c)) return c;
+
+        return 0;
+    }
+
+    static handle_opaque_t encode(uint8_t shard, uint8_t size_class, handle_opaque_t inner)
+    {
+        return ((handle_opaque_t)shard << shard_shift) |
+               ((handle_opaque_t)size_class << class_shift) | inner;
+    }
+
+public:
+    static uint8_t get_shard(handle_opaque_t handle)
+    {
+        return handle >> shard_shift;
+    }
+
+    static uint8_t get_handle_class(handle_opaque_t handle)
+    {
+        return (handle >> class_shift) & class_count;
+    }
+
+    static handle_opaque_t get_inner(handle_opaque_t handle)
+    {
+        return handle & inner_mask();
+    }
+
+private:
+    // stable per thread #, handed out in order of first use
+    static size_t thread_ordinal()
+    {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t ordinal = next++;
+
+        return ordinal;
+    }
+
+    // slot is normally exclusive to calling thread, so spin is only ever
+    // contended when more than cache_slots threads are active
+    CacheSlot& acquire_cache()
+    {
+        CacheSlot& slot = cache[thread_ordinal() % cache_slots];
+
+        while(slot.busy.test_and_set(std::memory_order_acquire));
+
+        return slot;
+    }
+
+    static void release_cache(CacheSlot& slot)
+    {
+        slot.busy.clear(std::memory_order_release);
+    }
+
+    handle_opaque_t allocate_from_shard(uint8_t shard, uint8_t size_class, size_t size)
+    {
+        Shard& s = shards[shard];
+        std::lock_guard<std::mutex> guard(s.mutex);
+
+        handle_opaque_t inner = s.memory->allocate(size);
+
+        if(inner == invalid_handle) return invalid_handle;
+
+        if(inner >= inner_mask())
+        {
+            ASSERT_WARN(true, false, "underlying handle too wide to shard");
+            s.memory->free(inner);
+            return invalid_handle;
+        }
+
+        return encode(shard, size_class, inner);
+    }
+
+    /// @return NULLPTR for invalid_handle, or any other handle naming a
+    /// shard we don't have
+    Shard* get_shard_of(handle_opaque_t handle)
+    {
+        if(handle == invalid_handle || get_shard(handle) >= shard_count) return NULLPTR;
+
+        return &shards[get_shard(handle)];
+    }
+
+    bool free_to_shard(handle_opaque_t handle)
+    {
+        Shard* s = get_shard_of(handle);
+
+        if(s == NULLPTR) return false;
+
+        std::lock_guard<std::mutex> guard(s->mutex);
+
+        return s->memory->free(get_inner(handle));
+    }
+
+public:
+    /// @param memory shards to allocate from.  Caller retains ownership
+    /// @param count # of shards, no more than max_shards
+    ShardedMemory(IMemory** memory, uint8_t count) :
+        shard_count(count)
+    {
+        ASSERT_ERROR(true, count > 0 && count <= max_shards, "invalid shard count");
+
+        for(uint8_t i = 0; i < count; i++)
+        {
+            shards[i].memory = memory[i];
+            shards[i].locks = 0;
+        }
+
+        for(size_t i = 0; i < cache_slots; i++)
+        {
+            cache[i].busy.clear();
+            memset(cache[i].count, 0, sizeof(cache[i].count));
+        }
+    }
+
+    ~ShardedMemory()
+    {
+        flush();
+    }
+
+    /// Returns all cached blocks to their shards
+    void flush()
+    {
+        for(size_t i = 0; i < cache_slots; i++)
+        {
+            CacheSlot& slot = cache[i];
+
+            while(slot.busy.test_and_set(std::memory_order_acquire));
+
+            for(uint8_t c = 0; c < class_count; c++)
+            {
+                for(size_t j = 0; j < slot.count[c]; j++)
+                    free_to_shard(slot.handles[c][j]);
+
+                slot.count[c] = 0;
+            }
+
+            release_cache(slot);
+        }
+    }
+
+    virtual handle_opaque_t allocate(size_t size) OVERRIDE
+    {
+        uint8_t size_class = get_size_class(size);
+
+        if(size_class != 0)
+        {
+            CacheSlot& slot = acquire_cache();
+            uint8_t& count = slot.count[size_class - 1];
+            handle_opaque_t h = count > 0 ? slot.handles[size_class - 1][--count] : invalid_handle;
+
+            release_cache(slot);
+
+            if(h != invalid_handle) return h;
+
+            // round up so block is reusable by anything else in its class
+            size = class_size(size_class);
+        }
+
+        uint8_t home = thread_ordinal() % shard_count;
+
+        // fall back to neighboring shards when home shard is exhausted
+        for(uint8_t i = 0; i < shard_count; i++)
+        {
+            uint8_t shard = (home + i) % shard_count;
+            handle_opaque_t h = allocate_from_shard(shard, size_class, size);
+
+            if(h != invalid_handle) return h;
+        }
+
+        return invalid_handle;
+    }
+
+    virtual handle_opaque_t allocate(const void* data, size_t size, size_t size_copy = 0) OVERRIDE
+    {
+        handle_opaque_t h = allocate(size);
+
+        if(h == invalid_handle) return h;
+
+        if(size_copy == 0) size_copy = size;
+
+        memcpy(lock(h), data, size_copy);
+        unlock(h);
+
+        return h;
+    }
+
+    virtual bool free(handle_opaque_t handle) OVERRIDE
+    {
+        Shard* s = get_shard_of(handle);
+
+        if(s == NULLPTR) return false;
+
+        uint8_t size_class = get_handle_class(handle);
+
+        // with locks outstanding, handle may be one of them.  Shard decides
+        if(size_class != 0 && s->locks.load(std::memory_order_relaxed) == 0)
+        {
+            CacheSlot& slot = acquire_cache();
+            uint8_t& count = slot.count[size_class - 1];
+            bool cached = count < cache_depth;
+
+            if(cached) slot.handles[size_class - 1][count++] = handle;
+
+            release_cache(slot);
+
+            if(cached) return true;
+        }
+
+        return free_to_shard(handle);
+    }
+
+    virtual bool expand(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        Shard* s = get_shard_of(handle);
+
+        if(s == NULLPTR) return false;
+
+        std::lock_guard<std::mutex> guard(s->mutex);
+
+        return s->memory->expand(get_inner(handle), size);
+    }
+
+    virtual void shrink(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        uint8_t size_class = get_handle_class(handle);
+
+        // cached blocks must remain large enough for anything in their class
+        if(size_class != 0 && size < class_size(size_class))
+            size = class_size(size_class);
+
+        Shard* s = get_shard_of(handle);
+
+        if(s == NULLPTR) return;
+
+        std::lock_guard<std::mutex> guard(s->mutex);
+
+        s->memory->shrink(get_inner(handle), size);
+    }
+
+    // underlying pools may compact or otherwise rearrange memory, so even
+    // lock/unlock go through the shard's mutex
+    virtual void* lock(handle_opaque_t handle) OVERRIDE
+    {
+        Shard* s = get_shard_of(handle);
+
+        if(s == NULLPTR) return NULLPTR;
+
+        std::lock_guard<std::mutex> guard(s->mutex);
+
+        void* p = s->memory->lock(get_inner(handle));
+
+        if(p != NULLPTR) s->locks++;
+
+        return p;
+    }
+
+    virtual void unlock(handle_opaque_t handle) OVERRIDE
+    {
+        Shard* s = get_shard_of(handle);
+
+        if(s == NULLPTR) return;
+
+        std::lock_guard<std::mutex> guard(s->mutex);
+
+        s->memory->unlock(get_inner(handle));
+
+        if(s->locks > 0) s->locks--;
+    }
+};
+
+#endif
+
+}}
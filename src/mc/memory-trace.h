@@ -0,0 +1,280 @@
+#pragma once
+
+#include "mem/platform.h"
+#include "memory.h"
+
+#include <stdio.h>
+
+#ifdef __CPP11__
+#include <chrono>
+#endif
+
+namespace moducom { namespace dynamic {
+
+// Compact binary trace of IMemory traffic.  A trace starts with 'MCMT' and
+// a version byte, followed by records of:
+//
+//   op        1 byte TraceOp, high bit set when the call failed
+//   delta     varint, microseconds since previous record
+//   handle    varint, handle as returned by traced IMemory (invalid_handle on failure)
+//   size      varint, only present for allocate, expand and shrink
+//
+// Varints are LEB128 - 7 bits per byte, low bits first, high bit set on all
+// but last byte.  Handles are logged as-is, replay maps them onto its own
+struct MemoryTrace
+{
+    enum TraceOp
+    {
+        Allocate = 0,
+        Free = 1,
+        Expand = 2,
+        Shrink = 3,
+        Lock = 4,
+        Unlock = 5
+    };
+
+    enum
+    {
+        version = 2,
+        failed_bit = 0x80,
+        // op + 3 maximal 64-bit varints
+        max_record_size = 1 + 3 * 10
+    };
+
+    struct Record
+    {
+        TraceOp op;
+        uint64_t delta_us;
+        IMemory::handle_opaque_t handle;
+        uint64_t size;
+        // free or expand returned false, lock returned NULLPTR.  A failed
+        // allocation is recorded as invalid_handle instead
+        bool failed;
+    };
+
+    static bool has_size(TraceOp op)
+    {
+        return op == Allocate || op == Expand || op == Shrink;
+    }
+
+    static const uint8_t* magic() { return (const uint8_t*)"MCMT"; }
+
+    /// @return bytes written to out, at most 10
+    static size_t encode_varint(uint64_t value, uint8_t* out)
+    {
+        size_t n = 0;
+
+        while(value >= 0x80)
+        {
+            out[n++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+
+        out[n++] = (uint8_t)value;
+
+        return n;
+    }
+
+    /// @return bytes consumed, or 0 if in ran out first
+    static size_t decode_varint(const uint8_t* in, size_t len, uint64_t* value)
+    {
+        *value = 0;
+
+        for(size_t n = 0; n < len && n < 10; n++)
+        {
+            *value |= (uint64_t)(in[n] & 0x7F) << (7 * n);
+
+            if(!(in[n] & 0x80)) return n + 1;
+        }
+
+        return 0;
+    }
+
+    /// @return bytes written to out, at most max_record_size
+    static size_t encode(const Record& r, uint8_t* out)
+    {
+        size_t n = 0;
+
+        out[n++] = r.failed ? (uint8_t)(r.op | failed_bit) : (uint8_t)r.op;
+        n += encode_varint(r.delta_us, out + n);
+        n += encode_varint(r.handle, out + n);
+
+        if(has_size(r.op)) n += encode_varint(r.size, out + n);
+
+        return n;
+    }
+
+    /// @return bytes consumed, or 0 if record is truncated or malformed
+    static size_t decode(const uint8_t* in, size_t len, Record* r)
+    {
+        uint64_t value;
+        size_t n = 1, consumed;
+
+        if(len == 0 || (in[0] & ~failed_bit) > Unlock) return 0;
+
+        r->op = (TraceOp)(in[0] & ~failed_bit);
+        r->failed = (in[0] & failed_bit) != 0;
+
+        if(!(consumed = decode_varint(in + n, len - n, &r->delta_us))) return 0;
+        n += consumed;
+
+        if(!(consumed = decode_varint(in + n, len - n, &value))) return 0;
+        n += consumed;
+        r->handle = (IMemory::handle_opaque_t)value;
+
+        r->size = 0;
+
+        if(has_size(r->op))
+        {
+            if(!(consumed = decode_varint(in + n, len - n, &r->size))) return 0;
+            n += consumed;
+        }
+
+        return n;
+    }
+};
+
+
+// Writes trace to a stdio FILE, which remains owned by caller
+class FileTraceWriter
+{
+    FILE* file;
+
+public:
+    FileTraceWriter(FILE* file) : file(file) {}
+
+    void write(const uint8_t* data, size_t len)
+    {
+        fwrite(data, 1, len, file);
+    }
+};
+
+
+#ifdef __CPP11__
+struct SteadyTraceClock
+{
+    static uint64_t now_us()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+#endif
+
+
+// IMemory decorator which logs each call, along with its outcome, to TWriter
+// in MemoryTrace format once the decorated IMemory has returned
+// TWriter needs a write(const uint8_t* data, size_t len) method
+// TClock needs a static uint64_t now_us() method
+#ifdef __CPP11__
+template <class TWriter, class TClock = SteadyTraceClock>
+#else
+template <class TWriter, class TClock>
+#endif
+class TracingMemory : public IMemory
+{
+    IMemory& memory;
+    TWriter& writer;
+    uint64_t last_us;
+
+    void record(MemoryTrace::TraceOp op, handle_opaque_t handle, size_t size = 0, bool failed = false)
+    {
+        MemoryTrace::Record r;
+        uint8_t buffer[MemoryTrace::max_record_size];
+        uint64_t now = TClock::now_us();
+
+        r.op = op;
+        r.delta_us = now - last_us;
+        r.handle = handle;
+        r.size = size;
+        r.failed = failed;
+
+        last_us = now;
+
+        writer.write(buffer, MemoryTrace::encode(r, buffer));
+    }
+
+public:
+    TracingMemory(IMemory& memory, TWriter& writer) :
+        memory(memory),
+        writer(writer),
+        last_us(TClock::now_us())
+    {
+        writer.write(MemoryTrace::magic(), 4);
+
+        uint8_t v = MemoryTrace::version;
+
+        writer.write(&v, 1);
+    }
+
+    virtual handle_opaque_t allocate(size_t size) OVERRIDE
+    {
+        handle_opaque_t h = memory.allocate(size);
+
+        record(MemoryTrace::Allocate, h, size);
+
+        return h;
+    }
+
+    virtual handle_opaque_t allocate(const void* data, size_t size, size_t size_copy = 0) OVERRIDE
+    {
+        handle_opaque_t h = memory.allocate(data, size, size_copy);
+
+        record(MemoryTrace::Allocate, h, size);
+
+        return h;
+    }
+
+    virtual bool free(handle_opaque_t handle) OVERRIDE
+    {
+        bool ok = memory.free(handle);
+
+        record(MemoryTrace::Free, handle, 0, !ok);
+
+        return ok;
+    }
+
+    virtual bool expand(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        bool ok = memory.expand(handle, size);
+
+        record(MemoryTrace::Expand, handle, size, !ok);
+
+        return ok;
+    }
+
+    virtual void shrink(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        memory.shrink(handle, size);
+
+        record(MemoryTrace::Shrink, handle, size);
+    }
+
+    // logged as an allocation, since that's what copy amounts to for replay
+    virtual handle_opaque_t copy(handle_opaque_t copy_from, size_t size, size_t size_copy) OVERRIDE
+    {
+        handle_opaque_t h = memory.copy(copy_from, size, size_copy);
+
+        record(MemoryTrace::Allocate, h, size);
+
+        return h;
+    }
+
+    virtual void* lock(handle_opaque_t handle) OVERRIDE
+    {
+        void* p = memory.lock(handle);
+
+        record(MemoryTrace::Lock, handle, 0, p == NULLPTR);
+
+        return p;
+    }
+
+    virtual void unlock(handle_opaque_t handle) OVERRIDE
+    {
+        memory.unlock(handle);
+
+        record(MemoryTrace::Unlock, handle);
+    }
+};
+
+}}
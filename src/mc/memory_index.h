@@ -1,7 +1,5 @@
 #pragma once
 
-#pragma once
-
 #include "mem/platform.h"
 #include "../MemoryPool.h"
 
@@ -17,15 +15,51 @@ struct PACKED MemoryPoolIndexedHandlePage : MemoryPoolHandlePage
     typedef IMemory::handle_opaque_t handle_opaque_t;
 
 private:
-    handle_t indexedHandle[];
+    // handles run contiguously across all directory pages
+    handle_t* handles() const
+    {
+        return (handle_t*)get_handle_area();
+    }
+
+    void set_handle_count(size_t count)
+    {
+        if(header.followup)
+            get_extension()->size = count;
+        else
+            header.size = count;
+    }
 
 public:
-    // initialize with total page_count available to free_page
-    void initialize(uint8_t free_page, uint8_t page_count);
+    /// initialize with total page_count available to free_page.  Pages before
+    /// free_page make up the handle directory
+    /// @param geometry recorded in directory, if not NULLPTR
+    void initialize(uint8_t free_page, uint8_t page_count, const Geometry* geometry = NULLPTR);
 
     const handle_t& get_descriptor(uint8_t handle) const
     {
-        return indexedHandle[handle];
+        return handles()[handle];
+    }
+
+    handle_t& get_descriptor(uint8_t handle)
+    {
+        return handles()[handle];
+    }
+
+    /// # of handle slots in use, including uninitialized ones within that range
+    size_t handle_count() const
+    {
+        return header.followup ? get_extension()->size : header.size;
+    }
+
+    /// total number of handles which can fit in the handle directory
+    size_t handle_capacity(size_t page_size) const
+    {
+        size_t total = get_handle_area_size(page_size) / sizeof(handle_t);
+        // single page directories track count in 4 bit header.size, others
+        // in 8 bit DirectoryExtension::size
+        size_t max = header.followup ? 0xFF : 15;
+
+        return total < max ? total : max;
     }
 
     uint8_t get_page(uint8_t handle) const
@@ -39,7 +73,7 @@ public:
     {
         size_t total = 0;
 
-        for(int i = 0; i < header.size; i++)
+        for(size_t i = 0; i < handle_count(); i++)
         {
             const handle_t& handle = get_descriptor(i);
 
@@ -56,9 +90,9 @@ public:
     // Get first unallocated handle or -1 if all present handles are allocated
     handle_opaque_t get_first_unallocated_handle() const
     {
-        for(size_t i = 0; i < header.size; i++)
+        for(size_t i = 0; i < handle_count(); i++)
         {
-            const handle_t& descriptor = indexedHandle[i];
+            const handle_t& descriptor = handles()[i];
 
             if(!descriptor.allocated)
                 return i;
@@ -67,26 +101,137 @@ public:
         return IMemory::invalid_handle;
     }
 
+    /// Get first unallocated handle whose run is at least minimum pages large
+    /// or nullptr if none qualifies.  Does a first-fit match
+    handle_t* get_unallocated_handle(uint8_t minimum, handle_opaque_t* index);
+
     /// Low-level function does NOT initialize handle_t
     handle_t* get_new_handle(size_t total)
     {
-        if(header.size >= total) return NULLPTR;
+        size_t count = handle_count();
+
+        if(count >= total) return NULLPTR;
 
         // we can expand our active handle index count here since there's room
-        return &indexedHandle[header.size++];
+        set_handle_count(count + 1);
+        return &handles()[count];
+    }
+
+    /// Like get_new_handle, but first reuses any uninitialized handle slot
+    /// Low-level function does NOT initialize handle_t
+    handle_t* get_uninitialized_handle(size_t total, handle_opaque_t* index)
+    {
+        for(size_t i = 0; i < handle_count(); i++)
+        {
+            if(!handles()[i].is_initialized())
+            {
+                *index = i;
+                return &handles()[i];
+            }
+        }
+
+        *index = handle_count();
+        return get_new_handle(total);
+    }
+
+    /// Finds the handle whose run begins at page, or nullptr if none does
+    handle_t* find_handle_by_page(uint8_t page)
+    {
+        for(size_t i = 0; i < handle_count(); i++)
+        {
+            handle_t& descriptor = handles()[i];
+
+            if(descriptor.is_initialized() && descriptor.page == page)
+                return &descriptor;
+        }
+
+        return NULLPTR;
+    }
+
+    void* lock(handle_opaque_t handle, uint8_t* pages, size_t page_size)
+    {
+        handle_t& descriptor = handles()[handle];
+
+        ASSERT(true, descriptor.allocated);
+        ASSERT(false, descriptor.locked);
+
+        descriptor.locked = true;
+
+        return pages + (page_size * descriptor.page);
+    }
+
+    void unlock(handle_opaque_t handle)
+    {
+        handle_t& descriptor = handles()[handle];
+
+        ASSERT(true, descriptor.allocated);
+        ASSERT(true, descriptor.locked);
+
+        descriptor.locked = false;
     }
 
-    void free(handle_opaque_t handle)
+    /// Frees handle, immediately merging it with any free runs physically
+    /// adjacent.  Handle slots absorbed by the merge become uninitialized and
+    /// available for reuse
+    void free(handle_opaque_t handle, size_t page_count)
     {
-        indexedHandle[handle].allocated = false;
+        handles()[handle].allocated = false;
+
+        coalesce(handle, page_count);
     }
 
+    /// Merge free run with free runs physically before and after it
+    void coalesce(handle_opaque_t handle, size_t page_count);
+
+    /// Finds the handle whose run ends just before page, or nullptr if none does
+    handle_t* find_handle_ending_at(uint8_t page)
+    {
+        for(size_t i = 0; i < handle_count(); i++)
+        {
+            handle_t& descriptor = handles()[i];
+
+            if(descriptor.is_initialized() && descriptor.page + descriptor.size == page)
+                return &descriptor;
+        }
+
+        return NULLPTR;
+    }
+
+    /// Grows handle in place by absorbing (part of) the free run physically following it
+    /// @return true if handle is now at least size_in_pages large
+    bool expand(handle_opaque_t handle, uint8_t size_in_pages, size_t page_count);
+
+    /// Splits off tail pages beyond size_in_pages and returns them to the free pool.
+    /// Does nothing if no handle is available to track the tail
+    void shrink(handle_opaque_t handle, uint8_t size_in_pages, size_t page_size, size_t page_count);
+
+    /// Exchanges the runs two handles point to
+    void swap(handle_opaque_t handle1, handle_opaque_t handle2)
+    {
+        handle_t& h1 = handles()[handle1];
+        handle_t& h2 = handles()[handle2];
+        uint8_t page = h1.page;
+        uint8_t size = h1.size;
+
+        h1.page = h2.page;
+        h1.size = h2.size;
+        h2.page = page;
+        h2.size = size;
+    }
+
+    /// Performs one unit of compaction work: either slides the first movable
+    /// (unlocked) allocation down into the free run just before it, or merges
+    /// two adjacent free runs
+    /// @param pages 0-based, inclusive of system page
+    /// @return false if there was no compaction work left to do
+    bool compact_step(uint8_t* pages, size_t page_size, size_t page_count);
+
     /// Compact two adjacent and contiguous free handles into specified handle
     /// @param handle left side/first of two free handles
     void combine_adjacent(handle_opaque_t handle)
     {
-        handle_t& left = indexedHandle[handle];
-        handle_t& right = indexedHandle[handle + 1];
+        handle_t& left = handles()[handle];
+        handle_t& right = handles()[handle + 1];
 
         left.combine(right);
     }
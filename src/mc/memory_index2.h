@@ -11,14 +11,20 @@ namespace moducom { namespace dynamic {
 #endif
 
 
-struct PACKED MemoryPoolIndexed2HandlePage : MemoryPoolHandlePage
+/// Indexed2 handle directory.  TIndex is the width of page numbers, run sizes
+/// and handle numbers.  uint8_t gives the compact format MemoryPool uses, wider
+/// types the same layout for pools of more than 255 pages
+template <class TIndex>
+struct PACKED MemoryPoolIndexed2HandlePageT : MemoryPoolHandlePage
 {
+    typedef TIndex index_t;
+
     /// Actual handle(s) residing within system page 0
     struct PACKED Index2Handle
     {
         /// which page this handle points to.  0 is reserved always for system handle
         /// descriptor area, and therefore is repurposed as an "inactive" indicator
-        uint8_t page;
+        TIndex page;
 
         bool is_active() const { return page != 0; }
 
@@ -26,17 +32,23 @@ struct PACKED MemoryPoolIndexed2HandlePage : MemoryPoolHandlePage
         // only used for ACTIVE Index2Handle
         struct PACKED PageData
         {
-            bool locked : 1;
-            bool allocated : 1;
+            /// # of outstanding locks.  Nonzero pins run in place, so compaction
+            /// and expand only ever move runs nobody holds a pointer into
+            uint8_t lock_count : 7;
+            uint8_t allocated : 1;
 
             /// # of utilized pages valid values from 1-255
-            uint8_t size;
+            TIndex size;
+
+            static CONSTEXPR uint8_t max_lock_count() { return 0x7F; }
+
+            bool is_locked() const { return lock_count != 0; }
 
             /// Initialize an active but unlocked and unallocated
             /// page
-            PageData(uint8_t size)
+            PageData(TIndex size)
             {
-                locked = false;
+                lock_count = 0;
                 allocated = false;
                 this->size = size;
             }
@@ -48,68 +60,291 @@ struct PACKED MemoryPoolIndexed2HandlePage : MemoryPoolHandlePage
         };
     };
 
+    /// Segregated index of free runs, residing at the tail end of system page 0.
+    /// Entries are kept sorted by run size and bucket_mask notes which power-of-two
+    /// size classes are present, so best-fit lookups never touch the data pages.
+    /// When more free runs exist than fit, only the largest ones are indexed and
+    /// 'partial' is set.  Every unindexed free run is then no larger than any indexed one
+    struct PACKED FreeRunIndex
+    {
+        struct PACKED Entry
+        {
+            TIndex handle;
+            /// # of pages in free run
+            TIndex size;
+        };
+
+        /// bit n set = an indexed free run of 2^n to 2^(n+1)-1 pages is present
+        TIndex bucket_mask;
+        uint8_t count : 7;
+        bool partial : 1;
+
+    private:
+        Entry entries[];
+
+        void remove_at(size_t i)
+        {
+            for(count--; i < count; i++)
+                entries[i] = entries[i + 1];
+
+            rebuild_mask();
+        }
+
+        void rebuild_mask()
+        {
+            bucket_mask = 0;
+
+            for(size_t i = 0; i < count; i++)
+                bucket_mask |= (TIndex)1 << size_class(entries[i].size);
+        }
+
+    public:
+        /// number of entries which fit in the quarter of system page reserved for index
+        static size_t capacity(size_t page_size)
+        {
+            size_t reserved = page_size / 4;
+
+            if(reserved <= sizeof(FreeRunIndex)) return 0;
+
+            size_t n = (reserved - sizeof(FreeRunIndex)) / sizeof(Entry);
+
+            // count is only 7 bits
+            return n < 0x7F ? n : 0x7F;
+        }
+
+        /// bytes of system page occupied by index
+        static size_t footprint(size_t page_size)
+        {
+            return sizeof(FreeRunIndex) + capacity(page_size) * sizeof(Entry);
+        }
+
+        static uint8_t size_class(TIndex size)
+        {
+            uint8_t c = 0;
+
+            while(size >>= 1) c++;
+
+            return c;
+        }
+
+        void clear()
+        {
+            bucket_mask = 0;
+            count = 0;
+            partial = false;
+        }
+
+        const Entry& operator[](size_t i) const { return entries[i]; }
+
+        /// @return position of handle within index, or -1 if not indexed
+        int find(TIndex handle) const
+        {
+            for(size_t i = 0; i < count; i++)
+                if(entries[i].handle == handle) return i;
+
+            return -1;
+        }
+
+        /// @return position of smallest indexed run at least minimum pages large, or -1
+        int best_fit(TIndex minimum) const
+        {
+            // no size class large enough is present at all
+            if((bucket_mask >> size_class(minimum)) == 0) return -1;
+
+            size_t low = 0, high = count;
+
+            // entries are sorted by size, so binary search for first large enough
+            while(low < high)
+            {
+                size_t mid = (low + high) / 2;
+
+                if(entries[mid].size < minimum) low = mid + 1;
+                else high = mid;
+            }
+
+            return low < count ? (int)low : -1;
+        }
+
+        /// @return false if run didn't make it into the index
+        bool insert(TIndex handle, TIndex size, size_t capacity)
+        {
+            // unindexed runs may be up to as large as smallest indexed one, so a smaller
+            // run can't go in without breaking that.  It's picked up on next reindex
+            if(partial && (count == 0 || size < entries[0].size)) return false;
+
+            if(count == capacity)
+            {
+                // only the largest runs are kept indexed
+                partial = true;
+
+                if(capacity == 0 || size <= entries[0].size) return false;
+
+                remove_at(0);
+            }
+
+            size_t i = count++;
+
+            for(; i > 0 && entries[i - 1].size > size; i--)
+                entries[i] = entries[i - 1];
+
+            entries[i].handle = handle;
+            entries[i].size = size;
+            bucket_mask |= (TIndex)1 << size_class(size);
+
+            return true;
+        }
+
+        void remove(TIndex handle)
+        {
+            int i = find(handle);
+
+            if(i >= 0) remove_at(i);
+        }
+
+        /// reflect a change in size of a free run, indexing it if it wasn't already.
+        /// In a partial index a run which shrank below the smallest indexed one is dropped
+        void update(TIndex handle, TIndex size, size_t capacity)
+        {
+            remove(handle);
+            insert(handle, size, capacity);
+        }
+    };
+
     typedef Index2Handle handle_t;
+    typedef typename handle_t::PageData page_data_t;
     typedef IMemory::handle_opaque_t handle_opaque_t;
 
 private:
-    handle_t indexedHandle[];
+    // handles run contiguously across all directory pages
+    handle_t* handles() const
+    {
+        return (handle_t*)get_handle_area();
+    }
 
 public:
-    const handle_t& get_descriptor(uint8_t handle) const
+    const handle_t& get_descriptor(TIndex handle) const
     {
-        return indexedHandle[handle];
+        return handles()[handle];
+    }
+
+    /// total number of handles which can fit in the handle directory
+    size_t handle_capacity(size_t page_size) const
+    {
+        size_t total = (get_handle_area_size(page_size) - FreeRunIndex::footprint(page_size)) /
+                sizeof(handle_t);
+
+        // handle numbers must stay clear of invalid_handle and fit FreeRunIndex::Entry
+        // additionally header.size exponent, 4 bits, caps directory at 2^15 handles
+        const size_t limit = (TIndex)-1 < 0x7FFF ? (TIndex)-1 : 0x7FFF;
+
+        return total < limit ? total : limit;
+    }
+
+    /// free run index sits at the tail end of the last directory page
+    FreeRunIndex& get_free_runs(size_t page_size) const
+    {
+        uint8_t* sys_page = (uint8_t*)this;
+        size_t directory_size = get_directory_pages() * page_size;
+
+        return *reinterpret_cast<FreeRunIndex*>(sys_page + directory_size - FreeRunIndex::footprint(page_size));
+    }
+
+    /// Rebuilds free run index by visiting every active handle.  This does touch
+    /// the data pages, so is only done when a partial index runs dry
+    void reindex(uint8_t* pages, size_t page_size)
+    {
+        FreeRunIndex& free_runs = get_free_runs(page_size);
+        const size_t capacity = FreeRunIndex::capacity(page_size);
+        const size_t size_approximate = get_approximate_header_size(page_size);
+
+        free_runs.clear();
+
+        for(size_t i = 0; i < size_approximate; i++)
+        {
+            const handle_t& descriptor = get_descriptor(i);
+
+            if(!descriptor.is_active()) continue;
+
+            const page_data_t* p = page_data_at(pages, page_size, descriptor.page);
+
+            if(!p->allocated) free_runs.insert(i, p->size, capacity);
+        }
+    }
+
+    /// Note a free run's new size in the free run index
+    void free_run_resized(handle_opaque_t handle, TIndex size, size_t page_size)
+    {
+        get_free_runs(page_size).update(handle, size, FreeRunIndex::capacity(page_size));
+    }
+
+    /// Note a free run is no longer free, or no longer exists
+    void free_run_removed(handle_opaque_t handle, size_t page_size)
+    {
+        get_free_runs(page_size).remove(handle);
+    }
+
+    /// PageData header residing at the start of the specified page
+    static page_data_t* page_data_at(uint8_t* pages, size_t page_size, size_t page)
+    {
+        return reinterpret_cast<page_data_t*>(pages + (page_size * page));
     }
 
     /// initialize with total byte count of page_size
-    /// @param blank_page Page 1 from memory pool - note this should *already* have its size field initialized
-    void initialize(size_t page_size, handle_t::PageData* blank_page)
+    /// @param blank_page First page past the directory - note this should *already* have its size field initialized
+    /// @param directory_pages # of pages, starting with this one, dedicated to handles
+    /// @param geometry recorded in directory, if not NULLPTR
+    void initialize(size_t page_size, page_data_t* blank_page, uint8_t directory_pages = 1,
+                    const Geometry* geometry = NULLPTR)
     {
         header.tier = IMemory::Indexed2;
-        header.size = 1;
+        // 2^0 = one handle
+        header.size = 0;
 
-        page_size -= sizeof(MemoryPoolHandlePage);
+        initialize_directory(directory_pages, geometry);
 
         // NOTE: Just a formality, don't need to do a sizeof since it's exactly one byte
         // doing it anyway cuz should optimize out and saves us if we do have to increase
         // size of handle_t
-        for(size_t i = 1; i < page_size / sizeof(handle_t); i++)
+        for(size_t i = 1; i < handle_capacity(page_size); i++)
         {
-            indexedHandle[i].page = 0;
+            handles()[i].page = 0;
         }
 
-        indexedHandle[0].page = 1;
+        handles()[0].page = directory_pages;
 
         blank_page->allocated = false;
-        blank_page->locked = false;
+        blank_page->lock_count = 0;
+
+        get_free_runs(page_size).clear();
+        free_run_resized(0, blank_page->size, page_size);
     }
 
 
-    uint8_t get_page(handle_opaque_t handle) const
+    TIndex get_page(handle_opaque_t handle) const
     {
-        uint8_t page = get_descriptor(handle).page;
+        TIndex page = get_descriptor(handle).page;
         return page;
     }
 
-    size_t get_approximate_header_size() const
+    /// Upper bound of handles which may be active.  header.size holds a power
+    /// of two exponent, so 4 bits cover any directory size
+    size_t get_approximate_header_size(size_t page_size) const
     {
-        return header.size;
-// TODO: re-enable this approximator, we need an algorithm to create the initial
-// approximation.  Probably evaluate what the header.size currently is, then see if
-// it's grown past its threshold value
-// during the ALLOCATION operation, we do have an exact value in which we found the
-// new handle(s) so that's a key thing to hang it off of
-        //return 1 << (size_t) header.size;
+        size_t approximate = (size_t)1 << header.size;
+        size_t capacity = handle_capacity(page_size);
+
+        return approximate < capacity ? approximate : capacity;
     }
 
-    typedef void (*page_data_iterator_fn)(void* context, handle_opaque_t handle, uint8_t page);
+    typedef void (*page_data_iterator_fn)(void* context, handle_opaque_t handle, TIndex page);
 
-    void iterate_page_data(page_data_iterator_fn callback, void* context = NULLPTR) const
+    void iterate_page_data(size_t page_size, page_data_iterator_fn callback, void* context = NULLPTR) const
     {
-        size_t count = get_approximate_header_size();
+        size_t count = get_approximate_header_size(page_size);
 
         for(size_t i = 0; i < count; i++)
         {
-            const handle_t& h = indexedHandle[i];
+            const handle_t& h = handles()[i];
 
             if(h.is_active()) callback(context, i, h.page);
         }
@@ -119,18 +354,17 @@ public:
 #endif
 
 
-    // FIX: temporarily passing in page_size until we settle down
-    // get_approximate_header_size() behavior
-    handle_opaque_t get_first_inactive_handle(size_t page_size) const
+    /// Keeps approximate header size large enough to cover a newly activated handle
+    void track_active(handle_opaque_t handle)
     {
-        // always reflects more elements than are actually
-        // present to optimize lookups in large page sizes
-        // (remember each handle we can ascertain as active
-        // by itself - by it being page == 0 or not)
-        const size_t size_approximate = get_approximate_header_size();
+        while(((size_t)1 << header.size) <= handle) header.size++;
+    }
 
-        //for(size_t i = 0; i < size_approximate; i++)
-        for(size_t i = 0; i < page_size / sizeof(handle_t); i++)
+    handle_opaque_t get_first_inactive_handle(size_t page_size) const
+    {
+        // inactive handles may lie past the approximate header size, so
+        // whole directory is considered
+        for(size_t i = 0; i < handle_capacity(page_size); i++)
         {
             if(!get_descriptor(i).is_active())
                 return i;
@@ -139,12 +373,26 @@ public:
         return IMemory::invalid_handle;
     }
 
+    /// Finds the active handle pointing to page, or invalid_handle if none does
+    handle_opaque_t find_handle_by_page(TIndex page, size_t page_size) const
+    {
+        const size_t size_approximate = get_approximate_header_size(page_size);
+
+        for(size_t i = 0; i < size_approximate; i++)
+        {
+            if(get_descriptor(i).page == page)
+                return i;
+        }
+
+        return IMemory::invalid_handle;
+    }
+
     //!
     //! \param handle
     //! \param pages 0-based, inclusive of system page
     //! \param page_size
     //! \return
-    handle_t::PageData& get_page_data(handle_opaque_t handle, uint8_t* pages, size_t page_size)
+    page_data_t& get_page_data(handle_opaque_t handle, uint8_t* pages, size_t page_size)
     {
         ASSERT(true, pages != NULLPTR);
 
@@ -152,7 +400,7 @@ public:
 
         ASSERT(true, descriptor.is_active());
 
-        handle_t::PageData* p = reinterpret_cast<handle_t::PageData*>(
+        page_data_t* p = reinterpret_cast<page_data_t*>(
                 pages + (page_size * descriptor.page));
 
         return *p;
@@ -161,13 +409,13 @@ public:
     // TBD
     // doesn't assign page size just yet
     // see if we can consolidate with above one
-    handle_t::PageData& new_page_data(handle_opaque_t new_handle, uint8_t page, uint8_t* pages, size_t page_size)
+    page_data_t& new_page_data(handle_opaque_t new_handle, TIndex page, uint8_t* pages, size_t page_size)
     {
-        handle_t& descriptor = indexedHandle[new_handle];
+        handle_t& descriptor = handles()[new_handle];
 
         descriptor.page = page;
 
-        handle_t::PageData* p = reinterpret_cast<handle_t::PageData*>(
+        page_data_t* p = reinterpret_cast<page_data_t*>(
                 pages + (page_size * descriptor.page));
 
         return *p;
@@ -177,52 +425,376 @@ public:
     //! \param handle
     //! \param pages
     //! \param page_size
-    //! \return
+    //! \return NULLPTR if handle is already locked max_lock_count() times
     void* lock(handle_opaque_t handle, uint8_t* pages, size_t page_size)
     {
-        handle_t::PageData& page_data = get_page_data(handle, pages, page_size);
+        page_data_t& page_data = get_page_data(handle, pages, page_size);
 
         ASSERT(true, page_data.allocated);
-        ASSERT(false, page_data.locked);
 
-        page_data.locked = true;
+        // counting further would wrap lock_count to 0, unpinning the run
+        if(page_data.lock_count == page_data_t::max_lock_count()) return NULLPTR;
 
-        return (uint8_t *)(&page_data) + sizeof(handle_t::PageData);
+        page_data.lock_count++;
+
+        return (uint8_t *)(&page_data) + sizeof(page_data_t);
     }
 
     void unlock(handle_opaque_t handle, uint8_t* pages, size_t page_size)
     {
-        handle_t::PageData& page_data = get_page_data(handle, pages, page_size);
+        page_data_t& page_data = get_page_data(handle, pages, page_size);
 
         ASSERT(true, page_data.allocated);
-        ASSERT(true, page_data.locked);
+        ASSERT(true, page_data.is_locked());
 
-        page_data.locked = false;
+        page_data.lock_count--;
     }
 
-    void free(handle_opaque_t handle, uint8_t* pages, size_t page_size)
+    /// Frees handle, immediately merging it with any free runs physically
+    /// adjacent.  Handles absorbed by the merge return to the inactive set
+    void free(handle_opaque_t handle, uint8_t* pages, size_t page_size, size_t page_count)
     {
-        handle_t::PageData& page_data = get_page_data(handle, pages, page_size);
+        page_data_t& page_data = get_page_data(handle, pages, page_size);
 
         ASSERT(true, page_data.allocated);
-        ASSERT(false, page_data.locked);
+        ASSERT(false, page_data.is_locked());
 
         page_data.allocated = false;
+
+        coalesce(handle, pages, page_size, page_count);
+    }
+
+    /// Finds free run ending just before page, or invalid_handle if there is none.
+    /// Sizes come from the free run index, so data pages are only visited when
+    /// the index is partial
+    handle_opaque_t find_free_run_ending_at(TIndex page, uint8_t* pages, size_t page_size) const
+    {
+        const FreeRunIndex& free_runs = get_free_runs(page_size);
+
+        for(size_t i = 0; i < free_runs.count; i++)
+        {
+            const typename FreeRunIndex::Entry& entry = free_runs[i];
+
+            if(get_page(entry.handle) + entry.size == page) return entry.handle;
+        }
+
+        if(!free_runs.partial) return IMemory::invalid_handle;
+
+        const size_t size_approximate = get_approximate_header_size(page_size);
+
+        for(size_t i = 0; i < size_approximate; i++)
+        {
+            const handle_t& descriptor = get_descriptor(i);
+
+            if(!descriptor.is_active()) continue;
+
+            const page_data_t* p = page_data_at(pages, page_size, descriptor.page);
+
+            if(!p->allocated && descriptor.page + p->size == page) return i;
+        }
+
+        return IMemory::invalid_handle;
+    }
+
+    /// Merge free run with free runs physically before and after it, retiring
+    /// the handles which were absorbed
+    void coalesce(handle_opaque_t handle, uint8_t* pages, size_t page_size, size_t page_count)
+    {
+        page_data_t* freed = page_data_at(pages, page_size, get_page(handle));
+        size_t next_page = get_page(handle) + freed->size;
+
+        if(next_page < page_count)
+        {
+            page_data_t* next = page_data_at(pages, page_size, next_page);
+
+            if(!next->allocated)
+            {
+                handle_opaque_t next_handle = find_handle_by_page(next_page, page_size);
+
+                freed->size += next->size;
+                handles()[next_handle].page = 0;
+                free_run_removed(next_handle, page_size);
+            }
+        }
+
+        handle_opaque_t prev_handle = find_free_run_ending_at(get_page(handle), pages, page_size);
+
+        if(prev_handle != IMemory::invalid_handle)
+        {
+            page_data_t* prev = page_data_at(pages, page_size, get_page(prev_handle));
+
+            prev->size += freed->size;
+            handles()[handle].page = 0;
+            free_run_removed(handle, page_size);
+
+            handle = prev_handle;
+            freed = prev;
+        }
+
+        free_run_resized(handle, freed->size, page_size);
+    }
+
+    /// Grows handle in place by absorbing (part of) the free run physically following it
+    /// @param size_in_pages new size, inclusive of PageData header
+    /// @return true if handle is now at least size_in_pages large
+    bool expand(handle_opaque_t handle, TIndex size_in_pages, uint8_t* pages, size_t page_size, size_t page_count)
+    {
+        page_data_t& page_data = get_page_data(handle, pages, page_size);
+
+        if(size_in_pages <= page_data.size) return true;
+
+        size_t next_page = get_page(handle) + page_data.size;
+
+        if(next_page >= page_count) return false;
+
+        page_data_t* next = page_data_at(pages, page_size, next_page);
+        TIndex needed = size_in_pages - page_data.size;
+
+        if(next->allocated || next->size < needed) return false;
+
+        handle_opaque_t next_handle = find_handle_by_page(next_page, page_size);
+
+        if(next->size == needed)
+        {
+            handles()[next_handle].page = 0;
+            free_run_removed(next_handle, page_size);
+        }
+        else
+        {
+            // free run remainder gets its PageData rewritten further up
+            page_data_t& remainder = new_page_data(next_handle, next_page + needed, pages, page_size);
+
+            remainder.size = next->size - needed;
+            remainder.allocated = false;
+            remainder.lock_count = 0;
+
+            free_run_resized(next_handle, remainder.size, page_size);
+        }
+
+        page_data.size = size_in_pages;
+
+        return true;
+    }
+
+    /// Splits off tail pages beyond size_in_pages and returns them to the free pool.
+    /// Does nothing if no handle is available to track the tail
+    /// @param size_in_pages new size, inclusive of PageData header
+    void shrink(handle_opaque_t handle, TIndex size_in_pages, uint8_t* pages, size_t page_size, size_t page_count)
+    {
+        page_data_t& page_data = get_page_data(handle, pages, page_size);
+
+        if(size_in_pages >= page_data.size) return;
+
+        TIndex tail_page = get_page(handle) + size_in_pages;
+        TIndex tail_size = page_data.size - size_in_pages;
+        size_t next_page = get_page(handle) + page_data.size;
+        handle_opaque_t tail_handle = IMemory::invalid_handle;
+
+        if(next_page < page_count && !page_data_at(pages, page_size, next_page)->allocated)
+        {
+            // free run following us simply grows downward to take in the tail
+            tail_handle = find_handle_by_page(next_page, page_size);
+            tail_size += page_data_at(pages, page_size, next_page)->size;
+        }
+        else
+        {
+            tail_handle = get_first_inactive_handle(page_size);
+
+            if(tail_handle == IMemory::invalid_handle) return;
+
+            track_active(tail_handle);
+        }
+
+        page_data_t& tail = new_page_data(tail_handle, tail_page, pages, page_size);
+
+        tail.size = tail_size;
+        tail.allocated = false;
+        tail.lock_count = 0;
+
+        free_run_resized(tail_handle, tail_size, page_size);
+
+        page_data.size = size_in_pages;
+    }
+
+    /// Exchanges the runs two handles point to.  PageData stays with its page
+    void swap(handle_opaque_t handle1, handle_opaque_t handle2)
+    {
+        TIndex page = handles()[handle1].page;
+
+        handles()[handle1].page = handles()[handle2].page;
+        handles()[handle2].page = page;
+    }
+
+    /// Performs one unit of compaction work: either slides the first movable
+    /// (unlocked) allocation down into the free run just before it, or merges
+    /// two adjacent free runs.  Handle numbers are preserved, only the page
+    /// they point to changes
+    /// @param pages 0-based, inclusive of system page
+    /// @return false if there was no compaction work left to do
+    bool compact_step(uint8_t* pages, size_t page_size, size_t page_count)
+    {
+        // walk runs in physical order.  Runs always tile all pages past the directory
+        size_t page = get_directory_pages();
+
+        while(page < page_count)
+        {
+            page_data_t* current = page_data_at(pages, page_size, page);
+            size_t next_page = page + current->size;
+
+            if(current->allocated || next_page >= page_count)
+            {
+                page = next_page;
+                continue;
+            }
+
+            page_data_t* next = page_data_at(pages, page_size, next_page);
+            handle_opaque_t next_handle = find_handle_by_page(next_page, page_size);
+
+            ASSERT_ERROR(false, next_handle == IMemory::invalid_handle, "no handle found for page " << next_page);
+
+            if(next_handle == IMemory::invalid_handle) return false;
+
+            if(!next->allocated)
+            {
+                // absorb adjacent free run and retire its handle
+                current->size += next->size;
+                handles()[next_handle].page = 0;
+                free_run_removed(next_handle, page_size);
+                free_run_resized(find_handle_by_page(page, page_size), current->size, page_size);
+                return true;
+            }
+
+            if(next->is_locked())
+            {
+                page = next_page + next->size;
+                continue;
+            }
+
+            // slide unlocked allocation (PageData included) down into free run,
+            // free run then sits just after it
+            handle_opaque_t current_handle = find_handle_by_page(page, page_size);
+            TIndex free_size = current->size;
+            TIndex moved_size = next->size;
+
+            memmove(pages + page * page_size,
+                    pages + next_page * page_size,
+                    moved_size * page_size);
+
+            handles()[next_handle].page = page;
+            handles()[current_handle].page = page + moved_size;
+
+            page_data_t* moved_free = page_data_at(pages, page_size, page + moved_size);
+
+            moved_free->size = free_size;
+            moved_free->allocated = false;
+            moved_free->lock_count = 0;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    /// Marks free run handle allocated, first splitting off any pages beyond
+    /// size_in_pages into a new free run.  If no handle is available to track
+    /// that remainder, the whole run is handed out
+    void claim(handle_opaque_t handle, page_data_t* page_data, TIndex size_in_pages,
+               uint8_t* pages, size_t page_size)
+    {
+        if(page_data->size > size_in_pages)
+        {
+            handle_opaque_t new_handle = get_first_inactive_handle(page_size);
+
+            if(new_handle != IMemory::invalid_handle)
+            {
+                // remainder starts just past the pages being claimed
+                page_data_t& remainder = new_page_data(new_handle, get_page(handle) + size_in_pages,
+                                                       pages, page_size);
+
+                remainder.size = page_data->size - size_in_pages;
+                remainder.allocated = false;
+                remainder.lock_count = 0;
+
+                page_data->size = size_in_pages;
+
+                track_active(new_handle);
+                free_run_resized(new_handle, remainder.size, page_size);
+            }
+        }
+
+        page_data->allocated = true;
+        free_run_removed(handle, page_size);
+    }
+
+    /**!
+     * Finds smallest free run at least minimum pages large, consulting only the free
+     * run index in system page 0.  Does a best-fit match among indexed runs.
+     * A partial index is refilled lazily - only once it's down to its largest
+     * run, which we'd rather not carve up while smaller runs sit unindexed, or
+     * once it has no fit at all.  So with more free runs than index capacity, data
+     * pages are walked at most once per (capacity - 1) allocations
+     * @param minimum size in pages
+     * @param pages
+     * @param page_size
+     * @param page_data
+     * @param walks incremented each time data pages had to be walked
+     * @return
+     */
+    handle_opaque_t  get_unallocated_handle(size_t minimum, uint8_t* pages, size_t page_size, page_data_t** page_data,
+                                            uint32_t* walks)
+    {
+        FreeRunIndex& free_runs = get_free_runs(page_size);
+        bool refilled = false;
+
+        // single entry indexes can only wait to run dry
+        if(free_runs.partial &&
+           (free_runs.count == 0 || (free_runs.count == 1 && FreeRunIndex::capacity(page_size) > 1)))
+        {
+            reindex(pages, page_size);
+            ++*walks;
+            refilled = true;
+        }
+
+        // index too small to be of use for this page_size
+        if(free_runs.partial && free_runs.count == 0)
+        {
+            ++*walks;
+            return get_unallocated_handle_scan(minimum, pages, page_size, page_data);
+        }
+
+        int i = free_runs.best_fit(minimum);
+
+        // a stale partial index may be missing a fit, i.e. from runs which coalesced
+        // while unindexed.  Look before caller resorts to compacting
+        if(i < 0 && free_runs.partial && !refilled)
+        {
+            reindex(pages, page_size);
+            ++*walks;
+            i = free_runs.best_fit(minimum);
+        }
+
+        if(i < 0) return IMemory::invalid_handle;
+
+        handle_opaque_t handle = free_runs[i].handle;
+
+        *page_data = &get_page_data(handle, pages, page_size);
+
+        return handle;
     }
 
     /**!
      * Scouring through active and unallocated handles, find one whose minimum size meets our requirement
-     * Does a best-fit match
-     * @param minimum
+     * Does a best-fit match.  Touches every data page, so only used when free run index is unavailable
+     * @param minimum size in pages
      * @param pages
      * @param page_size
      * @param page_data
      * @return
      */
-    handle_opaque_t  get_unallocated_handle(size_t minimum, uint8_t* pages, size_t page_size, handle_t::PageData** page_data)
+    handle_opaque_t  get_unallocated_handle_scan(size_t minimum, uint8_t* pages, size_t page_size, page_data_t** page_data)
     {
-        const size_t size_approximate = get_approximate_header_size();
-        handle_t::PageData* candidate = NULLPTR;
+        const size_t size_approximate = get_approximate_header_size(page_size);
+        page_data_t* candidate = NULLPTR;
         int candidate_index;
 
         for(size_t i = 0; i < size_approximate; i++)
@@ -231,7 +803,7 @@ public:
 
             if(descriptor.is_active())
             {
-                handle_t::PageData* p = reinterpret_cast<handle_t::PageData*>(
+                page_data_t* p = reinterpret_cast<page_data_t*>(
                         pages + (page_size * descriptor.page));
 
                 if(!p->allocated && p->size >= minimum)
@@ -262,17 +834,26 @@ public:
 
     size_t get_total_unallocated_bytes(const uint8_t* pages, size_t page_size) const
     {
-        typedef const handle_t::PageData page_data_t;
-        const size_t size_approximate = get_approximate_header_size();
+        const size_t size_approximate = get_approximate_header_size(page_size);
+        const FreeRunIndex& free_runs = get_free_runs(page_size);
         size_t total = 0;
 
+        // complete index means we needn't visit data pages at all
+        if(!free_runs.partial)
+        {
+            for(size_t i = 0; i < free_runs.count; i++)
+                total += (free_runs[i].size * page_size) - sizeof(page_data_t);
+
+            return total;
+        }
+
         for(size_t i = 0; i < size_approximate; i++)
         {
             const handle_t& descriptor = get_descriptor(i);
 
             if(descriptor.is_active())
             {
-                page_data_t* p = reinterpret_cast<page_data_t*>(
+                const page_data_t* p = reinterpret_cast<const page_data_t*>(
                         pages + (page_size * descriptor.page));
 
                 if(!p->allocated) total += (p->size * page_size) - sizeof(page_data_t);
@@ -285,6 +866,9 @@ public:
 };
 
 
+typedef MemoryPoolIndexed2HandlePageT<uint8_t> MemoryPoolIndexed2HandlePage;
+
+
 #ifdef USE_PRAGMA_PACK
 #pragma pack()
 #endif
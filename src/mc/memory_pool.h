@@ -4,74 +4,336 @@
 #include "memory_index.h"
 #include "memory_index2.h"
 
+// define FEATURE_MC_MEM_POOL_NO_STATS to leave out MemoryPoolCounters upkeep
+#ifndef FEATURE_MC_MEM_POOL_NO_STATS
+#define FEATURE_MC_MEM_POOL_STATS
+#endif
+
+#if defined(FEATURE_MC_MEM_POOL_STATS) && defined(__CPP11__)
+#include <chrono>
+#endif
+
 namespace moducom { namespace dynamic {
 
-template <size_t page_size = 32, uint8_t page_count = 128>
-class MemoryPool : public IMemory
+// Running totals a MemoryPool keeps up to date as it goes, never by walking handles
+struct MemoryPoolCounters
 {
-    uint8_t pages[page_count][page_size];
+    /// bytes presently allocated, rounded up to whole pages
+    size_t bytes_in_use;
+    size_t handles_in_use;
+    /// highest bytes_in_use has ever been
+    size_t high_water_mark;
+    /// allocations (including failed expands) which could not be satisfied
+    uint32_t allocation_failures;
+    uint32_t compaction_steps;
+    /// Indexed2 allocations which walked data pages, for want of a complete free run index
+    uint32_t free_run_walks;
+    /// time spent compacting.  Only measured with C++11 and up
+    uint32_t compaction_us;
+};
 
-    const MemoryPoolDescriptor& get_sys_page_descriptor() const
+
+// Point in time view of a MemoryPool, as returned by its stats()
+struct MemoryPoolStats : MemoryPoolCounters
+{
+    size_t free_bytes;
+    size_t largest_free_run;
+    /// 0 when all free space is one run, approaching 1 as it splinters
+    float fragmentation;
+};
+
+
+struct MemoryPoolIndexedTier;
+struct MemoryPoolIndexed2Tier;
+struct MemoryPoolRuntimeTier;
+
+
+// How MemoryPoolBase holds its pages: inline, or as a pointer to caller
+// supplied memory.  Either way pages[n] is page n
+template <size_t page_size, uint8_t page_count, bool external_pages>
+struct MemoryPoolPages
+{
+    typedef uint8_t type[page_count][page_size];
+};
+
+
+template <size_t page_size, uint8_t page_count>
+struct MemoryPoolPages<page_size, page_count, true>
+{
+    typedef uint8_t (*type)[page_size];
+};
+
+
+// Geometry policies.  Each supplies MemoryPoolBase its page storage, page
+// size and count, and the width of page numbers within the directory
+
+// Template fixed geometry, as MemoryPool has.  Pages inline, or for
+// external_pages a pointer to caller supplied memory
+template <size_t page_size_, uint8_t page_count_, bool external_pages>
+struct MemoryPoolFixedGeometry
+{
+    typedef uint8_t index_t;
+
+    typename MemoryPoolPages<page_size_, page_count_, external_pages>::type pages;
+
+    static CONSTEXPR size_t page_size() { return page_size_; }
+    static CONSTEXPR size_t page_count() { return page_count_; }
+
+    uint8_t* page(size_t n) const { return (uint8_t*)pages[n]; }
+};
+
+
+// Geometry decided at runtime, over caller supplied memory.  TIndex of uint16_t
+// or uint32_t lifts the 255 page cap of fixed geometry
+template <class TIndex>
+class MemoryPoolRuntimeGeometry
+{
+    uint8_t* pages;
+    size_t m_page_size;
+    size_t m_page_count;
+
+public:
+    typedef TIndex index_t;
+
+    /// NOTE: does not touch span.  Pages beyond what TIndex can number are left unused
+    MemoryPoolRuntimeGeometry(void* span, size_t span_size, size_t page_size) :
+        pages((uint8_t*)span),
+        m_page_size(page_size),
+        m_page_count(span_size / page_size < (TIndex)-1 ? span_size / page_size : (TIndex)-1) {}
+
+    size_t page_size() const { return m_page_size; }
+    size_t page_count() const { return m_page_count; }
+
+    uint8_t* page(size_t n) const { return pages + n * m_page_size; }
+};
+
+
+// Page storage plus the per-tier operations on it.  Which tier is in effect
+// is decided by the tier policy of the TieredMemoryPool built on top
+template <class TGeometry = MemoryPoolFixedGeometry<32, 128, false> >
+class MemoryPoolBase : protected TGeometry
+{
+    friend struct MemoryPoolIndexedTier;
+    friend struct MemoryPoolIndexed2Tier;
+    friend struct MemoryPoolRuntimeTier;
+
+protected:
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+    typedef typename TGeometry::index_t index_t;
+    typedef MemoryPoolIndexed2HandlePageT<index_t> index2_page_t;
+    typedef typename index2_page_t::page_data_t page_data_t;
+
+    using TGeometry::page_size;
+    using TGeometry::page_count;
+    using TGeometry::page;
+
+#ifdef FEATURE_MC_MEM_POOL_STATS
+    MemoryPoolCounters counters;
+
+    MemoryPoolBase()
     {
-        return *((MemoryPoolDescriptor*)pages[0]);
+        memset(&counters, 0, sizeof(counters));
     }
 
-    MemoryPoolIndexedHandlePage& get_sys_page_index() const
+    MemoryPoolBase(const TGeometry& geometry) : TGeometry(geometry)
     {
-        return *((MemoryPoolIndexedHandlePage*)pages[0]);
+        memset(&counters, 0, sizeof(counters));
     }
 
-    MemoryPoolIndexed2HandlePage& get_sys_page_index2() const
+    static uint32_t now_us()
     {
-        return *((MemoryPoolIndexed2HandlePage*)pages[0]);
+#ifdef __CPP11__
+        return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+        return 0;
+#endif
     }
+#else
+    MemoryPoolBase() {}
+    MemoryPoolBase(const TGeometry& geometry) : TGeometry(geometry) {}
+#endif
 
+    // stats upkeep, each compiles away entirely without FEATURE_MC_MEM_POOL_STATS
 
-    void initialize_index()
+    template <class TTier>
+    void track_allocate(handle_opaque_t handle)
     {
-        typedef MemoryPoolIndexedHandlePage pool_t;
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        if(handle == IMemory::invalid_handle)
+        {
+            counters.allocation_failures++;
+            return;
+        }
+
+        counters.handles_in_use++;
+        counters.bytes_in_use += TTier::get_size(*this, handle);
+
+        if(counters.bytes_in_use > counters.high_water_mark)
+            counters.high_water_mark = counters.bytes_in_use;
+#endif
+    }
+
+    template <class TTier>
+    void track_free(handle_opaque_t handle)
+    {
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        counters.handles_in_use--;
+        counters.bytes_in_use -= TTier::get_size(*this, handle);
+#endif
+    }
+
+    /// @return size of handle's allocation, for handing to track_resize
+    template <class TTier>
+    size_t track_size(handle_opaque_t handle)
+    {
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        return TTier::get_size(*this, handle);
+#else
+        return 0;
+#endif
+    }
+
+    template <class TTier>
+    void track_resize(handle_opaque_t handle, size_t size_before, bool success = true)
+    {
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        if(!success)
+        {
+            counters.allocation_failures++;
+            return;
+        }
 
-        pool_t* sys_page = (pool_t*)pages[0];
+        counters.bytes_in_use += TTier::get_size(*this, handle);
+        counters.bytes_in_use -= size_before;
 
-        sys_page->initialize(1, page_count - 1);
+        if(counters.bytes_in_use > counters.high_water_mark)
+            counters.high_water_mark = counters.bytes_in_use;
+#endif
     }
 
-    void initialize_index2()
+    /// Compacts using TTier, timing the work when stats are enabled
+    /// @return number of steps performed
+    template <class TTier>
+    size_t compact_steps(size_t max_steps)
     {
-        typedef MemoryPoolIndexed2HandlePage::handle_t::PageData page_data_t;
+        size_t steps = 0;
+
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        uint32_t started = now_us();
+#endif
 
-        page_data_t* page_data = (page_data_t*)(pages[1]);
+        while(steps < max_steps && TTier::compact_step(*this)) steps++;
 
-        page_data->size = page_count -1;
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        counters.compaction_steps += steps;
+        counters.compaction_us += now_us() - started;
+#endif
 
-        get_sys_page_index2().initialize(page_size, page_data);
+        return steps;
     }
 
-    static uint8_t get_size_in_pages(size_t size)
+    // Rebuilds usage counters from the handle directory, for pages which were
+    // populated elsewhere.  High water mark restarts from present usage
+    void recount_index()
     {
-        size_t size_in_pages = (size + page_size - 1) / page_size;
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        const MemoryPoolIndexedHandlePage& sys_page = get_sys_page_index();
+
+        memset(&counters, 0, sizeof(counters));
+
+        for(size_t i = 0; i < sys_page.handle_count(); i++)
+        {
+            const MemoryPoolIndexedHandlePage::handle_t& handle = sys_page.get_descriptor(i);
 
-        ASSERT(true, size_in_pages < 0xFF);
+            if(handle.is_initialized() && handle.allocated)
+            {
+                counters.handles_in_use++;
+                counters.bytes_in_use += handle.size * page_size();
+            }
+        }
 
-        return (uint8_t) size_in_pages;
+        counters.high_water_mark = counters.bytes_in_use;
+#endif
     }
 
-    void* lock_index2(handle_opaque_t handle)
+    void recount_index2()
+    {
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        get_allocated_handle_count_context context(*this);
+
+        context.filter_allocated = true;
+        get_sys_page_index2().iterate_page_data(page_size(), get_allocated_handle_count_callback, &context);
+
+        memset(&counters, 0, sizeof(counters));
+
+        counters.handles_in_use = context.total_handles;
+        counters.bytes_in_use = context.total_bytes;
+        counters.high_water_mark = counters.bytes_in_use;
+#endif
+    }
+
+    const MemoryPoolDescriptor& get_sys_page_descriptor() const
     {
-        return get_sys_page_index2().lock(handle, pages[0], page_size);
+        return *((MemoryPoolDescriptor*)page(0));
     }
 
-public:
-    MemoryPool(TierEnum tier = Indexed)
+    const MemoryPoolHandlePage& get_directory() const
+    {
+        return *((MemoryPoolHandlePage*)page(0));
+    }
+
+    /// geometry as recorded by pools whose span outlives them
+    MemoryPoolHandlePage::Geometry geometry() const
+    {
+        return MemoryPoolHandlePage::Geometry::make(page_size(), page_count(), sizeof(index_t));
+    }
+
+    MemoryPoolIndexedHandlePage& get_sys_page_index() const
+    {
+        return *((MemoryPoolIndexedHandlePage*)page(0));
+    }
+
+    index2_page_t& get_sys_page_index2() const
+    {
+        return *((index2_page_t*)page(0));
+    }
+
+
+    void initialize_index(uint8_t directory_pages, const MemoryPoolHandlePage::Geometry* geometry = NULLPTR)
+    {
+        typedef MemoryPoolIndexedHandlePage pool_t;
+
+        pool_t* sys_page = (pool_t*)page(0);
+
+        sys_page->initialize(directory_pages, page_count() - directory_pages, geometry);
+    }
+
+    void initialize_index2(uint8_t directory_pages, const MemoryPoolHandlePage::Geometry* geometry = NULLPTR)
+    {
+        page_data_t* page_data = (page_data_t*)(page(directory_pages));
+
+        page_data->size = page_count() - directory_pages;
+
+        get_sys_page_index2().initialize(page_size(), page_data, directory_pages, geometry);
+    }
+
+    /// @param directory_pages # of pages reserved for handles.  More than one lets
+    /// pools with many small allocations track more handles than page 0 holds
+    /// @param geometry recorded in directory, if not NULLPTR
+    void initialize(IMemory::TierEnum tier, uint8_t directory_pages,
+                    const MemoryPoolHandlePage::Geometry* geometry = NULLPTR)
     {
+        ASSERT_ERROR(true, directory_pages > 0 && directory_pages < page_count(), "invalid directory_pages");
+
         switch(tier)
         {
-            case Indexed:
-                initialize_index();
+            case IMemory::Indexed:
+                initialize_index(directory_pages, geometry);
                 break;
 
-            case Indexed2:
-                initialize_index2();
+            case IMemory::Indexed2:
+                initialize_index2(directory_pages, geometry);
                 break;
 
             default:
@@ -82,178 +344,342 @@ public:
         }
     }
 
-    void compact() {}
+    /// @return pages needed for size bytes.  May exceed what index_t holds, so
+    /// callers check against page_count() before narrowing
+    size_t get_size_in_pages(size_t size) const
+    {
+        return (size + page_size() - 1) / page_size();
+    }
 
-    virtual void* lock(handle_opaque_t handle) OVERRIDE
+    // Indexed2 pages also carry a PageData header in front of the user data
+    size_t get_size_in_pages_index2(size_t size) const
     {
-        switch(get_sys_page_descriptor().tier)
-        {
-            case Indexed:
-                //get_sys_page_index()
-                break;
+        return get_size_in_pages(size + sizeof(page_data_t));
+    }
 
-            case Indexed2:
-                return lock_index2(handle);
+    void* lock_index(handle_opaque_t handle)
+    {
+        return get_sys_page_index().lock(handle, page(0), page_size());
+    }
 
-            default: break;
+    void* lock_index2(handle_opaque_t handle)
+    {
+        return get_sys_page_index2().lock(handle, page(0), page_size());
+    }
+
+    void unlock_index(handle_opaque_t handle)
+    {
+        get_sys_page_index().unlock(handle);
+    }
+
+    void unlock_index2(handle_opaque_t handle)
+    {
+        get_sys_page_index2().unlock(handle, page(0), page_size());
+    }
+
+    bool compact_step_index()
+    {
+        return get_sys_page_index().compact_step(page(0), page_size(), page_count());
+    }
+
+    bool compact_step_index2()
+    {
+        return get_sys_page_index2().compact_step(page(0), page_size(), page_count());
+    }
+
+    uint8_t* get_data_index(handle_opaque_t handle)
+    {
+        return page(get_sys_page_index().get_descriptor(handle).page);
+    }
+
+    uint8_t* get_data_index2(handle_opaque_t handle)
+    {
+        return (uint8_t*)(&get_sys_page_index2().get_page_data(handle, page(0), page_size()) + 1);
+    }
+
+    size_t get_size_index(handle_opaque_t handle) const
+    {
+        return get_sys_page_index().get_descriptor(handle).size * page_size();
+    }
+
+    size_t get_size_index2(handle_opaque_t handle)
+    {
+        return get_sys_page_index2().get_page_data(handle, page(0), page_size()).size * page_size()
+                - sizeof(page_data_t);
+    }
+
+    size_t get_largest_free_run_index() const
+    {
+        typedef MemoryPoolIndexedHandlePage pool_t;
+        typedef pool_t::handle_t handle_t;
+
+        const pool_t& sys_page = get_sys_page_index();
+        uint8_t largest = 0;
+
+        for(size_t i = 0; i < sys_page.handle_count(); i++)
+        {
+            const handle_t& handle = sys_page.get_descriptor(i);
+
+            if(handle.is_initialized() && !handle.allocated && handle.size > largest)
+                largest = handle.size;
         }
 
-        return NULLPTR;
+        return largest * page_size();
     }
 
-    virtual void unlock(handle_opaque_t handle) OVERRIDE
+    size_t get_largest_free_run_index2() const
     {
-        switch(get_sys_page_descriptor().tier)
+        typedef index2_page_t pool_t;
+        typedef typename pool_t::handle_t handle_t;
+
+        const pool_t& sys_page = get_sys_page_index2();
+        const typename pool_t::FreeRunIndex& free_runs = sys_page.get_free_runs(page_size());
+        size_t largest = 0;
+
+        // index is sorted by size, and even when partial holds the largest runs
+        if(free_runs.count > 0)
+            largest = free_runs[free_runs.count - 1].size;
+        else if(free_runs.partial)
         {
-            case Indexed2:
-                get_sys_page_index2().unlock(handle, pages[0], page_size);
+            const size_t size_approximate = sys_page.get_approximate_header_size(page_size());
 
-            default: break;
+            for(size_t i = 0; i < size_approximate; i++)
+            {
+                const handle_t& descriptor = sys_page.get_descriptor(i);
+
+                if(!descriptor.is_active()) continue;
+
+                const page_data_t* p = reinterpret_cast<const page_data_t*>(page(descriptor.page));
+
+                if(!p->allocated && p->size > largest) largest = p->size;
+            }
         }
+
+        return largest == 0 ? 0 : largest * page_size() - sizeof(page_data_t);
     }
 
+public:
     handle_opaque_t allocate_index(size_t size)
     {
         typedef MemoryPoolIndexedHandlePage pool_t;
         typedef pool_t::handle_t handle_t;
 
-        pool_t* sys_page = (pool_t*)pages[0];
+        pool_t& sys_page = get_sys_page_index();
         // total = total number of handles that can fit in a page
-        CONSTEXPR size_t total = (page_size - sizeof(MemoryPoolDescriptor)) /
-                                 sizeof(handle_t);
+        const size_t total = sys_page.handle_capacity(page_size());
+        const size_t size_in_pages = get_size_in_pages(size);
         handle_opaque_t index;
 
-        handle_t* handle = sys_page->get_first_unallocated_handle(total, &index);
+        // larger than pool altogether
+        if(size_in_pages >= page_count()) return IMemory::invalid_handle;
 
-        if(handle != NULLPTR)
+        handle_t* handle = sys_page.get_unallocated_handle(size_in_pages, &index);
+
+        if(handle == NULLPTR)
         {
-            uint8_t size_in_pages = get_size_in_pages(size);
+            // if enough pages are free overall, we're merely fragmented.  Compact
+            // and try again
+            if(get_free_index() < size_in_pages * page_size()) return IMemory::invalid_handle;
 
-            if(size_in_pages == handle->size)
-            {
-                // EZ mode, exact size match, set allocated flag and return
-                handle->allocated = true;
-                // TODO: oops, need to be doing this all with handle #'s my bad
-                return index;
-            }
+            compact_steps<MemoryPoolIndexedTier>((size_t)-1);
 
-            // if requested size is too large, we'll need to attempt a compact and try again
-            if(size_in_pages > handle->size)
-            {
-                // TODO: Don't bother with a compact if we know there aren't discontiguous pages
-                compact();
+            handle = sys_page.get_unallocated_handle(size_in_pages, &index);
 
-                // TODO: Now try allocation again see if there's more contiguous memory
-            }
+            if(handle == NULLPTR) return IMemory::invalid_handle;
+        }
 
-            // if requested size is smaller than available handle
-            if(size_in_pages < handle->size)
-            {
-                // TODO: Keep scanning looking for a better fit
+        // if requested size is smaller than available handle
+        if(size_in_pages < handle->size)
+        {
+            handle_opaque_t new_index;
 
-                // split the free handle in two, with the new handle containing remainder unallocated space
-                handle_t* new_handle = sys_page->get_new_handle(total);
+            // split the free handle in two, with the new handle containing remainder unallocated space
+            handle_t* new_handle = sys_page.get_uninitialized_handle(total, &new_index);
+
+            // if no handle is available to track the remainder, the whole run is handed out
+            if(new_handle != NULLPTR)
+            {
                 new_handle->allocated = false;
+                new_handle->locked = false;
                 new_handle->page = handle->page + size_in_pages;
                 new_handle->size = handle->size - size_in_pages;
 
-                handle->allocated = true;
                 handle->size = size_in_pages;
-
-                return index;
             }
         }
 
-        return invalid_handle;
+        handle->allocated = true;
+        handle->locked = false;
+
+        return index;
     }
 
-    handle_opaque_t allocate_index2(size_t size)
+    /// Indexed2 free run lookup, counting any walk of the data pages it took
+    handle_opaque_t find_free_run_index2(size_t size_in_pages, page_data_t** page_data)
     {
-        typedef MemoryPoolIndexed2HandlePage pool_t;
-        typedef pool_t::handle_t handle_t;
-        typedef handle_t::PageData page_data_t;
-
-        pool_t& sys_page = get_sys_page_index2();
-        page_data_t* page_data;
-
-        handle_opaque_t handle = sys_page.get_unallocated_handle(size, pages[0], page_size, &page_data);
+        uint32_t walks = 0;
+        handle_opaque_t handle = get_sys_page_index2().get_unallocated_handle(
+                    size_in_pages, page(0), page_size(), page_data, &walks);
 
-        // TODO: Do split logic like allocate_index does
-        if(handle != invalid_handle)
-        {
-            size_t size_in_pages = get_size_in_pages(size);
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        counters.free_run_walks += walks;
+#endif
 
-            // Do split logic
-            if(page_data->size > size_in_pages)
-            {
-                // get brand new inactive handle to snap up and use
-                handle_opaque_t new_handle = sys_page.get_first_inactive_handle(page_size);
+        return handle;
+    }
 
-                ASSERT_ERROR(true, new_handle != invalid_handle, "Unable to find inactive handle");
+    handle_opaque_t allocate_index2(size_t size)
+    {
+        index2_page_t& sys_page = get_sys_page_index2();
+        page_data_t* page_data;
+        const size_t size_in_pages = get_size_in_pages_index2(size);
 
-                // get location of current unallocated page data, then increment just past end of it
-                // this forms the new_page data representing the shrunken remainder unallocated
-                // page data
-                uint8_t new_page = sys_page.get_page(handle) + size_in_pages;
+        // larger than pool altogether
+        if(size_in_pages >= page_count()) return IMemory::invalid_handle;
 
-                // set up new page data at location new page within pages buffer
-                // then be sure to assign the page_data size to the new shrunken remainder free memory
-                page_data_t& new_page_data = sys_page.new_page_data(new_handle, new_page, pages[0], page_size);
+        handle_opaque_t handle = find_free_run_index2(size_in_pages, &page_data);
 
-                new_page_data.size = page_data->size - size_in_pages;
-                new_page_data.allocated = false;
-                new_page_data.locked = false;
+        if(handle == IMemory::invalid_handle)
+        {
+            // if enough pages are free overall, we're merely fragmented.  Compact
+            // and try again
+            if(get_free_index2() < size) return IMemory::invalid_handle;
 
-            }
+            compact_steps<MemoryPoolIndexed2Tier>((size_t)-1);
 
-            page_data->allocated = true;
-            page_data->size = size_in_pages;
+            handle = find_free_run_index2(size_in_pages, &page_data);
 
-            // TODO: fix this for exponential behavior
-            sys_page.header.size++;
+            if(handle == IMemory::invalid_handle) return IMemory::invalid_handle;
         }
 
+        sys_page.claim(handle, page_data, (index_t)size_in_pages, page(0), page_size());
+
         return handle;
     }
 
-    virtual handle_opaque_t allocate(size_t size) OVERRIDE
+    // Batches carve n equal allocations out of one free run, so only a single
+    // free run lookup is paid for.  If no run is large enough, or handles run
+    // out partway, the rest fall back to one by one allocation
+    size_t allocate_n_index(handle_opaque_t* out, size_t n, size_t size)
     {
-        const MemoryPoolDescriptor& descriptor = get_sys_page_descriptor();
+        typedef MemoryPoolIndexedHandlePage pool_t;
+        typedef pool_t::handle_t handle_t;
 
-        // TODO: soon, replace with proper polymorphism
-        switch(descriptor.tier)
+        pool_t& sys_page = get_sys_page_index();
+        const size_t total = sys_page.handle_capacity(page_size());
+        const size_t size_in_pages = get_size_in_pages(size);
+        size_t done = 0;
+        handle_t* handle;
+
+        if(n > 1 && n * size_in_pages < page_count() &&
+           (handle = sys_page.get_unallocated_handle(n * size_in_pages, out)) != NULLPTR)
         {
-            case Indexed2:
-                return allocate_index2(size);
+            uint8_t next_page = handle->page + size_in_pages;
+            uint8_t remaining = handle->size - size_in_pages;
 
-            default:
-                return allocate_index(size);
+            handle->allocated = true;
+            handle->locked = false;
+            handle->size = size_in_pages;
+
+            for(done = 1; done < n; done++, next_page += size_in_pages, remaining -= size_in_pages)
+            {
+                handle_t* carved = sys_page.get_uninitialized_handle(total, &out[done]);
+
+                if(carved == NULLPTR) break;
+
+                carved->allocated = true;
+                carved->locked = false;
+                carved->page = next_page;
+                carved->size = size_in_pages;
+                handle = carved;
+            }
+
+            if(remaining > 0)
+            {
+                handle_opaque_t index;
+                handle_t* tail = sys_page.get_uninitialized_handle(total, &index);
+
+                // no handle to track the remainder, so last carved run takes it
+                if(tail == NULLPTR)
+                    handle->size += remaining;
+                else
+                {
+                    tail->allocated = false;
+                    tail->locked = false;
+                    tail->page = next_page;
+                    tail->size = remaining;
+                }
+            }
         }
-    }
 
+        for(; done < n; done++)
+            if((out[done] = allocate_index(size)) == IMemory::invalid_handle) break;
 
-    // untested
-    virtual handle_opaque_t allocate(const void* data, size_t size, size_t size_copy) OVERRIDE
+        return done;
+    }
+
+    size_t allocate_n_index2(handle_opaque_t* out, size_t n, size_t size)
     {
-        // FIX: optimize
-        handle_opaque_t h = allocate(size);
+        index2_page_t& sys_page = get_sys_page_index2();
+        const size_t size_in_pages = get_size_in_pages_index2(size);
+        size_t done = 0;
+        page_data_t* page_data;
 
-        void* locked = lock(h);
+        if(n > 1 && n * size_in_pages < page_count() &&
+           (out[0] = find_free_run_index2(n * size_in_pages, &page_data)) != IMemory::invalid_handle)
+        {
+            index_t next_page = sys_page.get_page(out[0]) + size_in_pages;
+            index_t remaining = page_data->size - size_in_pages;
 
-        if(size_copy == 0) size_copy = size;
+            page_data->allocated = true;
+            page_data->size = size_in_pages;
+            sys_page.free_run_removed(out[0], page_size());
 
-        memcpy(locked, data, size_copy);
+            for(done = 1; done < n; done++, next_page += size_in_pages, remaining -= size_in_pages)
+            {
+                handle_opaque_t carved = sys_page.get_first_inactive_handle(page_size());
 
-        unlock(h);
+                if(carved == IMemory::invalid_handle) break;
 
-        return h;
-    }
+                page_data = &sys_page.new_page_data(carved, next_page, page(0), page_size());
+                page_data->size = size_in_pages;
+                page_data->allocated = true;
+                page_data->lock_count = 0;
+
+                sys_page.track_active(carved);
+                out[done] = carved;
+            }
+
+            if(remaining > 0)
+            {
+                handle_opaque_t tail = sys_page.get_first_inactive_handle(page_size());
+
+                // no handle to track the remainder, so last carved run takes it
+                if(tail == IMemory::invalid_handle)
+                    page_data->size += remaining;
+                else
+                {
+                    page_data_t& tail_data = sys_page.new_page_data(tail, next_page, page(0), page_size());
+
+                    tail_data.size = remaining;
+                    tail_data.allocated = false;
+                    tail_data.lock_count = 0;
+
+                    sys_page.track_active(tail);
+                    sys_page.free_run_resized(tail, remaining, page_size());
+                }
+            }
+        }
 
+        for(; done < n; done++)
+            if((out[done] = allocate_index2(size)) == IMemory::invalid_handle) break;
 
+        return done;
+    }
 
     bool free_index(handle_opaque_t handle)
     {
-        get_sys_page_index().free(handle);
+        get_sys_page_index().free(handle, page_count());
 
         return true;
     }
@@ -261,97 +687,118 @@ public:
 
     bool free_index2(handle_opaque_t handle)
     {
-        get_sys_page_index2().free(handle, pages[0], page_size);
+        get_sys_page_index2().free(handle, page(0), page_size(), page_count());
 
         return true;
     }
 
+    // moves unlocked handle to a new run of at least size bytes, keeping its handle #
+    // and contents.  Old run is returned to the free pool
+    bool relocate_index(handle_opaque_t handle, size_t size)
+    {
+        typedef MemoryPoolIndexedHandlePage pool_t;
+        typedef pool_t::handle_t handle_t;
 
+        pool_t& sys_page = get_sys_page_index();
+        // NOTE: may compact, which in turn may move handle itself
+        handle_opaque_t new_handle = allocate_index(size);
 
-    virtual bool free(handle_opaque_t handle) OVERRIDE
-    {
-        switch(get_sys_page_descriptor().tier)
-        {
-            case Indexed2:
-                return free_index2(handle);
+        if(new_handle == IMemory::invalid_handle) return false;
 
-            default:
-                return free_index(handle);
-        }
+        const handle_t& from = sys_page.get_descriptor(handle);
+        const handle_t& to = sys_page.get_descriptor(new_handle);
+
+        memcpy(page(to.page), page(from.page), from.size * page_size());
+
+        sys_page.swap(handle, new_handle);
+
+        return free_index(new_handle);
     }
 
-    virtual bool expand(handle_opaque_t handle, size_t size) OVERRIDE
+    bool relocate_index2(handle_opaque_t handle, size_t size)
     {
-        size_t size_in_pages = get_size_in_pages(size);
+        index2_page_t& sys_page = get_sys_page_index2();
+        // NOTE: may compact, which in turn may move handle itself
+        handle_opaque_t new_handle = allocate_index2(size);
 
-        typedef MemoryPoolIndexedHandlePage pool_t;
-        typedef pool_t::handle_t handle_t;
+        if(new_handle == IMemory::invalid_handle) return false;
 
-        pool_t* sys_page = (pool_t*)pages[0];
+        const page_data_t& from = sys_page.get_page_data(handle, page(0), page_size());
+        page_data_t& to = sys_page.get_page_data(new_handle, page(0), page_size());
 
-        const handle_t& h = sys_page->get_descriptor(handle);
+        // copy user data only, each page keeps its own PageData
+        memcpy((uint8_t*)(&to + 1), (const uint8_t*)(&from + 1), from.size * page_size() - sizeof(page_data_t));
 
-        if(size_in_pages <= h.size)
-        {
-            // Memory blocks already big enough to accomodate expansion
-            return true;
-        }
-        else
-        {
-            // TODO: scour for contiguous unallocated memory page
-            // if none exists, choose either:
-            // a) swap allocated contiguous space elsewhere
-            // b) move this allocated memory to a new space which fits the expanded size
-            // c) compact operation and attempt a) and b) again
-        }
+        sys_page.swap(handle, new_handle);
 
-        return false;
+        return free_index2(new_handle);
     }
 
-    virtual void shrink(handle_opaque_t handle, size_t size) OVERRIDE
+    bool expand_index(handle_opaque_t handle, size_t size)
     {
+        MemoryPoolIndexedHandlePage& sys_page = get_sys_page_index();
+        const size_t size_in_pages = get_size_in_pages(size);
+
+        if(size_in_pages >= page_count()) return false;
+
+        if(sys_page.expand(handle, size_in_pages, page_count())) return true;
+
+        // locked memory may not move out from under its user
+        if(sys_page.get_descriptor(handle).locked) return false;
 
+        return relocate_index(handle, size);
     }
 
-    size_t get_free_index() const
+    bool expand_index2(handle_opaque_t handle, size_t size)
     {
-        size_t total = page_count - 1;
+        index2_page_t& sys_page = get_sys_page_index2();
+        const size_t size_in_pages = get_size_in_pages_index2(size);
 
-        typedef MemoryPoolIndexedHandlePage pool_t;
-        //typedef pool_t::handle_t handle_t;
+        if(size_in_pages >= page_count()) return false;
 
-        pool_t* sys_page = (pool_t*)pages[0];
+        if(sys_page.expand(handle, (index_t)size_in_pages, page(0), page_size(), page_count()))
+            return true;
 
-        total -= sys_page->get_total_allocated_pages();
+        // locked memory may not move out from under its user
+        if(sys_page.get_page_data(handle, page(0), page_size()).is_locked()) return false;
 
-        return total * page_size;
+        return relocate_index2(handle, size);
     }
 
+    void shrink_index(handle_opaque_t handle, size_t size)
+    {
+        get_sys_page_index().shrink(handle, get_size_in_pages(size), page_size(), page_count());
+    }
 
-    size_t get_free_index2() const
+    void shrink_index2(handle_opaque_t handle, size_t size)
     {
-        return get_sys_page_index2().get_total_unallocated_bytes(pages[0], page_size);
+        get_sys_page_index2().shrink(handle, (index_t)get_size_in_pages_index2(size),
+                                     page(0), page_size(), page_count());
     }
 
-    size_t get_free() const
+    size_t get_free_index() const
     {
-        switch(get_sys_page_descriptor().tier)
-        {
-            case Indexed:
-                return get_free_index();
+        typedef MemoryPoolIndexedHandlePage pool_t;
+        //typedef pool_t::handle_t handle_t;
 
-            case Indexed2:
-                return get_free_index2();
+        pool_t* sys_page = (pool_t*)page(0);
 
-            default: break;
-        }
+        size_t total = page_count() - sys_page->get_directory_pages();
 
-        return -1;
+        total -= sys_page->get_total_allocated_pages();
+
+        return total * page_size();
+    }
+
+
+    size_t get_free_index2() const
+    {
+        return get_sys_page_index2().get_total_unallocated_bytes(page(0), page_size());
     }
 
     struct get_allocated_handle_count_context
     {
-        const MemoryPool& memory_pool;
+        const MemoryPoolBase& memory_pool;
         // true = filter by allocated
         // false = filter by unallocated
         bool filter_allocated;
@@ -360,7 +807,7 @@ public:
         size_t total_handles;
         size_t total_locked;
 
-        get_allocated_handle_count_context(const MemoryPool& memory_pool) : memory_pool(memory_pool)
+        get_allocated_handle_count_context(const MemoryPoolBase& memory_pool) : memory_pool(memory_pool)
         {
             total_bytes = 0;
             total_handles = 0;
@@ -368,20 +815,18 @@ public:
         }
     };
 
-    static void get_allocated_handle_count_callback(void* context, handle_opaque_t handle, uint8_t page)
+    static void get_allocated_handle_count_callback(void* context, handle_opaque_t handle, index_t page)
     {
-        typedef MemoryPoolIndexed2HandlePage::handle_t::PageData page_data_t;
-
         get_allocated_handle_count_context* ctx = (get_allocated_handle_count_context*)context;
-        const MemoryPool& _this = ctx->memory_pool;
+        const MemoryPoolBase& _this = ctx->memory_pool;
 
-        page_data_t* page_data = (page_data_t*)_this.pages[page];
+        page_data_t* page_data = (page_data_t*)_this.page(page);
 
         if(!(ctx->filter_allocated ^ page_data->allocated))
         {
-            ctx->total_bytes += page_data->size * page_size - sizeof(page_data_t);
+            ctx->total_bytes += page_data->size * _this.page_size() - sizeof(page_data_t);
             ctx->total_handles++;
-            ctx->total_locked += page_data->locked;
+            ctx->total_locked += page_data->is_locked();
         }
     }
 
@@ -394,17 +839,1000 @@ public:
     {
         get_allocated_handle_count_context context(*this);
         context.filter_allocated = filter_allocated;
-        get_sys_page_index2().iterate_page_data(get_allocated_handle_count_callback, &context);
+        get_sys_page_index2().iterate_page_data(page_size(), get_allocated_handle_count_callback, &context);
         return context.total_handles;
     }
 };
 
 
-class MemoryPoolAggregator : public IMemory
+// Tier policies.  Each maps the tier-neutral pool operations onto one tier's
+// implementation, so with a fixed tier every call inlines straight through
+
+struct MemoryPoolIndexedTier
+{
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+
+    template <class TPool>
+    static void initialize(TPool& p, uint8_t directory_pages,
+                           const MemoryPoolHandlePage::Geometry* geometry = NULLPTR)
+    { p.initialize_index(directory_pages, geometry); }
+
+    template <class TPool>
+    static handle_opaque_t allocate(TPool& p, size_t size) { return p.allocate_index(size); }
+
+    template <class TPool>
+    static size_t allocate_n(TPool& p, handle_opaque_t* out, size_t n, size_t size)
+    { return p.allocate_n_index(out, n, size); }
+
+    template <class TPool>
+    static bool free(TPool& p, handle_opaque_t h) { return p.free_index(h); }
+
+    template <class TPool>
+    static void* lock(TPool& p, handle_opaque_t h) { return p.lock_index(h); }
+
+    template <class TPool>
+    static void unlock(TPool& p, handle_opaque_t h) { p.unlock_index(h); }
+
+    template <class TPool>
+    static bool expand(TPool& p, handle_opaque_t h, size_t size) { return p.expand_index(h, size); }
+
+    template <class TPool>
+    static void shrink(TPool& p, handle_opaque_t h, size_t size) { p.shrink_index(h, size); }
+
+    template <class TPool>
+    static bool compact_step(TPool& p) { return p.compact_step_index(); }
+
+    template <class TPool>
+    static size_t get_free(const TPool& p) { return p.get_free_index(); }
+
+    template <class TPool>
+    static uint8_t* get_data(TPool& p, handle_opaque_t h) { return p.get_data_index(h); }
+
+    template <class TPool>
+    static size_t get_size(TPool& p, handle_opaque_t h) { return p.get_size_index(h); }
+
+    template <class TPool>
+    static size_t get_largest_free_run(const TPool& p) { return p.get_largest_free_run_index(); }
+
+    template <class TPool>
+    static void recount(TPool& p) { p.recount_index(); }
+
+    static bool accepts(IMemory::TierEnum tier) { return tier == IMemory::Indexed; }
+};
+
+
+struct MemoryPoolIndexed2Tier
+{
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+
+    template <class TPool>
+    static void initialize(TPool& p, uint8_t directory_pages,
+                           const MemoryPoolHandlePage::Geometry* geometry = NULLPTR)
+    { p.initialize_index2(directory_pages, geometry); }
+
+    template <class TPool>
+    static handle_opaque_t allocate(TPool& p, size_t size) { return p.allocate_index2(size); }
+
+    template <class TPool>
+    static size_t allocate_n(TPool& p, handle_opaque_t* out, size_t n, size_t size)
+    { return p.allocate_n_index2(out, n, size); }
+
+    template <class TPool>
+    static bool free(TPool& p, handle_opaque_t h) { return p.free_index2(h); }
+
+    template <class TPool>
+    static void* lock(TPool& p, handle_opaque_t h) { return p.lock_index2(h); }
+
+    template <class TPool>
+    static void unlock(TPool& p, handle_opaque_t h) { p.unlock_index2(h); }
+
+    template <class TPool>
+    static bool expand(TPool& p, handle_opaque_t h, size_t size) { return p.expand_index2(h, size); }
+
+    template <class TPool>
+    static void shrink(TPool& p, handle_opaque_t h, size_t size) { p.shrink_index2(h, size); }
+
+    template <class TPool>
+    static bool compact_step(TPool& p) { return p.compact_step_index2(); }
+
+    template <class TPool>
+    static size_t get_free(const TPool& p) { return p.get_free_index2(); }
+
+    template <class TPool>
+    static uint8_t* get_data(TPool& p, handle_opaque_t h) { return p.get_data_index2(h); }
+
+    template <class TPool>
+    static size_t get_size(TPool& p, handle_opaque_t h) { return p.get_size_index2(h); }
+
+    template <class TPool>
+    static size_t get_largest_free_run(const TPool& p) { return p.get_largest_free_run_index2(); }
+
+    template <class TPool>
+    static void recount(TPool& p) { p.recount_index2(); }
+
+    static bool accepts(IMemory::TierEnum tier) { return tier == IMemory::Indexed2; }
+};
+
+
+// Tier read from page 0 on every call, as chosen at construction time
+struct MemoryPoolRuntimeTier
+{
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+
+    template <class TPool>
+    static void initialize(TPool& p, uint8_t directory_pages,
+                           const MemoryPoolHandlePage::Geometry* geometry = NULLPTR)
+    { p.initialize(IMemory::Indexed, directory_pages, geometry); }
+
+    template <class TPool>
+    static handle_opaque_t allocate(TPool& p, size_t size)
+    {
+        // TODO: soon, replace with proper polymorphism
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                return p.allocate_index2(size);
+
+            default:
+                return p.allocate_index(size);
+        }
+    }
+
+    template <class TPool>
+    static size_t allocate_n(TPool& p, handle_opaque_t* out, size_t n, size_t size)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                return p.allocate_n_index2(out, n, size);
+
+            default:
+                return p.allocate_n_index(out, n, size);
+        }
+    }
+
+    template <class TPool>
+    static bool free(TPool& p, handle_opaque_t h)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                return p.free_index2(h);
+
+            default:
+                return p.free_index(h);
+        }
+    }
+
+    template <class TPool>
+    static void* lock(TPool& p, handle_opaque_t h)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed:
+                return p.lock_index(h);
+
+            case IMemory::Indexed2:
+                return p.lock_index2(h);
+
+            default: break;
+        }
+
+        return NULLPTR;
+    }
+
+    template <class TPool>
+    static void unlock(TPool& p, handle_opaque_t h)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed:
+                p.unlock_index(h);
+                break;
+
+            case IMemory::Indexed2:
+                p.unlock_index2(h);
+                break;
+
+            default: break;
+        }
+    }
+
+    template <class TPool>
+    static bool expand(TPool& p, handle_opaque_t h, size_t size)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                return p.expand_index2(h, size);
+
+            default:
+                return p.expand_index(h, size);
+        }
+    }
+
+    template <class TPool>
+    static void shrink(TPool& p, handle_opaque_t h, size_t size)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                p.shrink_index2(h, size);
+                break;
+
+            default:
+                p.shrink_index(h, size);
+                break;
+        }
+    }
+
+    template <class TPool>
+    static bool compact_step(TPool& p)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed:
+                return p.compact_step_index();
+
+            case IMemory::Indexed2:
+                return p.compact_step_index2();
+
+            default: break;
+        }
+
+        return false;
+    }
+
+    template <class TPool>
+    static size_t get_free(const TPool& p)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed:
+                return p.get_free_index();
+
+            case IMemory::Indexed2:
+                return p.get_free_index2();
+
+            default: break;
+        }
+
+        return -1;
+    }
+
+    template <class TPool>
+    static uint8_t* get_data(TPool& p, handle_opaque_t h)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed:
+                return p.get_data_index(h);
+
+            case IMemory::Indexed2:
+                return p.get_data_index2(h);
+
+            default: break;
+        }
+
+        return NULLPTR;
+    }
+
+    template <class TPool>
+    static size_t get_size(TPool& p, handle_opaque_t h)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                return p.get_size_index2(h);
+
+            default:
+                return p.get_size_index(h);
+        }
+    }
+
+    template <class TPool>
+    static size_t get_largest_free_run(const TPool& p)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                return p.get_largest_free_run_index2();
+
+            default:
+                return p.get_largest_free_run_index();
+        }
+    }
+
+    template <class TPool>
+    static void recount(TPool& p)
+    {
+        switch(p.get_sys_page_descriptor().tier)
+        {
+            case IMemory::Indexed2:
+                p.recount_index2();
+                break;
+
+            default:
+                p.recount_index();
+                break;
+        }
+    }
+
+    static bool accepts(IMemory::TierEnum tier)
+    {
+        return tier == IMemory::Indexed || tier == IMemory::Indexed2;
+    }
+};
+
+
+// Pool API atop MemoryPoolBase, with tier fixed by TTier policy and page layout
+// by TGeometry policy.  Nothing here is virtual, so with MemoryPoolIndexedTier
+// or MemoryPoolIndexed2Tier hot paths inline with no tier switch.  Leaves pages
+// untouched; derived classes initialize them, or format()/adopt() a span
+template <class TTier, class TGeometry>
+class TieredMemoryPoolT : public MemoryPoolBase<TGeometry>
 {
+    typedef MemoryPoolBase<TGeometry> base_t;
+
+    template <class TTier2, class TGeometry2>
+    friend class TieredMemoryPoolT;
+
+protected:
+    TieredMemoryPoolT() {}
+    TieredMemoryPoolT(const TGeometry& geometry) : base_t(geometry) {}
+
+    /// Formats pages as a fresh, empty pool, recording geometry for adopt()
+    void format(uint8_t directory_pages)
+    {
+        const MemoryPoolHandlePage::Geometry geometry = base_t::geometry();
+
+        tier_t::initialize(*this, directory_pages, &geometry);
+    }
+
+    /// As above, for MemoryPoolRuntimeTier which learns its tier here
+    void format(IMemory::TierEnum tier, uint8_t directory_pages)
+    {
+        const MemoryPoolHandlePage::Geometry geometry = base_t::geometry();
+
+        base_t::initialize(tier, directory_pages, &geometry);
+    }
+
+    /// Takes up pages previously formatted by format(), rebuilding usage counters
+    /// @return false if pages don't hold a pool of this geometry and of a tier
+    /// we can operate on
+    bool adopt()
+    {
+        const MemoryPoolDescriptor& descriptor = base_t::get_sys_page_descriptor();
+        const MemoryPoolHandlePage::Geometry* recorded = base_t::get_directory().get_geometry();
+
+        if(recorded == NULLPTR || !(*recorded == base_t::geometry())) return false;
+
+        if(!tier_t::accepts((IMemory::TierEnum)descriptor.tier)) return false;
+
+        tier_t::recount(*this);
+
+        return true;
+    }
+
 public:
-    virtual handle_opaque_t allocate(size_t size) OVERRIDE { return -1; }
-    virtual bool free(handle_opaque_t handle) OVERRIDE { return false; }
+    typedef TTier tier_t;
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+
+    IMemory::TierEnum tier() const
+    {
+        return base_t::get_sys_page_descriptor().tier;
+    }
+
+    handle_opaque_t allocate(size_t size)
+    {
+        handle_opaque_t h = tier_t::allocate(*this, size);
+
+        base_t::template track_allocate<tier_t>(h);
+
+        return h;
+    }
+
+    /// Allocates size bytes and fills them from spans in order, writing
+    /// straight into pool pages without lock/unlock bookkeeping
+    /// @param size total allocation size, or 0 to size exactly to spans
+    /// @return invalid_handle if allocation failed or spans exceed size
+    handle_opaque_t allocate(const MemorySpan* spans, size_t span_count, size_t size = 0)
+    {
+        size_t total = 0;
+
+        for(size_t i = 0; i < span_count; i++) total += spans[i].length;
+
+        if(size == 0) size = total;
+
+        if(total > size) return IMemory::invalid_handle;
+
+        handle_opaque_t h = allocate(size);
+
+        if(h == IMemory::invalid_handle) return h;
+
+        uint8_t* dest = get_data(h);
+
+        for(size_t i = 0; i < span_count; i++)
+        {
+            memcpy(dest, spans[i].data, spans[i].length);
+            dest += spans[i].length;
+        }
+
+        return h;
+    }
+
+    handle_opaque_t allocate(const void* data, size_t size, size_t size_copy = 0)
+    {
+        MemorySpan span;
+
+        span.data = data;
+        span.length = size_copy == 0 ? size : size_copy;
+
+        return allocate(&span, 1, size);
+    }
+
+    /// Allocates n blocks of size bytes each, carving them from a single free
+    /// run when one is large enough
+    /// @return number of handles written to out, less than n only if pool ran out
+    size_t allocate_n(handle_opaque_t* out, size_t n, size_t size)
+    {
+        size_t count = tier_t::allocate_n(*this, out, n, size);
+
+        for(size_t i = 0; i < count; i++)
+            base_t::template track_allocate<tier_t>(out[i]);
+
+        if(count < n) base_t::template track_allocate<tier_t>(IMemory::invalid_handle);
+
+        return count;
+    }
+
+    bool free(handle_opaque_t handle)
+    {
+        base_t::template track_free<tier_t>(handle);
+
+        return tier_t::free(*this, handle);
+    }
+
+    void free_n(const handle_opaque_t* in, size_t n)
+    {
+        for(size_t i = 0; i < n; i++) free(in[i]);
+    }
+
+    void* lock(handle_opaque_t handle)
+    {
+        return tier_t::lock(*this, handle);
+    }
+
+    void unlock(handle_opaque_t handle)
+    {
+        tier_t::unlock(*this, handle);
+    }
+
+    /// Grows allocation to at least size bytes, keeping handle and contents intact.
+    /// First attempts to absorb the free run just after it, and failing that relocates
+    /// the (unlocked) allocation elsewhere, compacting if necessary
+    /// @return false if expansion wasn't possible, in which case allocation is untouched
+    bool expand(handle_opaque_t handle, size_t size)
+    {
+        size_t size_before = base_t::template track_size<tier_t>(handle);
+        bool success = tier_t::expand(*this, handle, size);
+
+        base_t::template track_resize<tier_t>(handle, size_before, success);
+
+        return success;
+    }
+
+    /// Reduces allocation to size bytes, returning whole tail pages to the free pool
+    void shrink(handle_opaque_t handle, size_t size)
+    {
+        size_t size_before = base_t::template track_size<tier_t>(handle);
+
+        tier_t::shrink(*this, handle, size);
+
+        base_t::template track_resize<tier_t>(handle, size_before);
+    }
+
+    /// Copies size_copy bytes of another pool's handle into a new size byte
+    /// allocation here, page to page.  Source may be this same pool
+    /// @param size_copy 0 for as much as fits.  Never more than size, nor
+    /// than source allocation holds
+    template <class TSourceTier, class TSourceGeometry>
+    handle_opaque_t copy(TieredMemoryPoolT<TSourceTier, TSourceGeometry>& source,
+                         handle_opaque_t copy_from, size_t size, size_t size_copy = 0)
+    {
+        if(copy_from == IMemory::invalid_handle) return IMemory::invalid_handle;
+
+        const size_t source_size = source.get_size(copy_from);
+
+        if(size_copy == 0 || size_copy > size) size_copy = size;
+        if(size_copy > source_size) size_copy = source_size;
+
+        handle_opaque_t h = allocate(size);
+
+        if(h == IMemory::invalid_handle) return h;
+
+        // fetched only now, as allocation may have compacted source
+        memcpy(get_data(h), source.get_data(copy_from), size_copy);
+
+        return h;
+    }
+
+    handle_opaque_t copy(handle_opaque_t copy_from, size_t size, size_t size_copy = 0)
+    {
+        return copy(*this, copy_from, size, size_copy);
+    }
+
+    /// Direct pointer to a handle's data, bypassing lock bookkeeping.  Only stable
+    /// until the next operation which may compact, unless handle is locked
+    uint8_t* get_data(handle_opaque_t handle)
+    {
+        return tier_t::get_data(*this, handle);
+    }
+
+    /// usable bytes of handle's allocation
+    size_t get_size(handle_opaque_t handle)
+    {
+        return tier_t::get_size(*this, handle);
+    }
+
+    /// Incremental compaction.  Each step either slides one unlocked allocation
+    /// down over the free run preceding it or merges two adjacent free runs.
+    /// Handles stay valid, though unlocked ones may point to new memory afterward
+    /// @param max_steps upper bound of work to perform, for latency sensitive callers
+    /// @return number of steps performed.  Less than max_steps means compaction is complete
+    size_t compact(size_t max_steps)
+    {
+        return base_t::template compact_steps<tier_t>(max_steps);
+    }
+
+    /// Full compaction pass, slides all unlocked allocations as low as they will go
+    /// and coalesces the free space left behind
+    void compact()
+    {
+        base_t::template compact_steps<tier_t>((size_t)-1);
+    }
+
+    size_t get_free() const
+    {
+        return tier_t::get_free(*this);
+    }
+
+    /// Snapshot of usage counters plus present free space layout.  Counters are
+    /// zero when built with FEATURE_MC_MEM_POOL_NO_STATS
+    MemoryPoolStats stats() const
+    {
+        MemoryPoolStats s;
+
+#ifdef FEATURE_MC_MEM_POOL_STATS
+        static_cast<MemoryPoolCounters&>(s) = base_t::counters;
+#else
+        memset(&s, 0, sizeof(s));
+#endif
+
+        s.free_bytes = get_free();
+        s.largest_free_run = tier_t::get_largest_free_run(*this);
+        s.fragmentation = s.free_bytes == 0 ? 0 :
+                1 - (float)s.largest_free_run / s.free_bytes;
+
+        return s;
+    }
+};
+
+
+// TieredMemoryPool of template fixed geometry, pages inline unless external_pages
+template <class TTier, size_t page_size = 32, uint8_t page_count = 128, bool external_pages = false>
+class TieredMemoryPool :
+    public TieredMemoryPoolT<TTier, MemoryPoolFixedGeometry<page_size, page_count, external_pages> >
+{
+    typedef TieredMemoryPoolT<TTier, MemoryPoolFixedGeometry<page_size, page_count, external_pages> > base_t;
+
+protected:
+    struct deferred_initialize_t {};
+
+    /// Leaves pages untouched, for pools whose pages are supplied and
+    /// initialized (or reopened) afterward
+    TieredMemoryPool(deferred_initialize_t) {}
+
+public:
+    typedef TTier tier_t;
+
+    /// @param directory_pages # of pages reserved for handles.  More than one lets
+    /// pools with many small allocations track more handles than page 0 holds
+    TieredMemoryPool(uint8_t directory_pages = 1)
+    {
+        tier_t::initialize(*this, directory_pages);
+    }
+
+    /// For MemoryPoolRuntimeTier, which learns its tier here
+    TieredMemoryPool(IMemory::TierEnum tier, uint8_t directory_pages)
+    {
+        base_t::initialize(tier, directory_pages);
+    }
+};
+
+
+template <size_t page_size = 32, uint8_t page_count = 128>
+class MemoryPool :
+    public IMemory,
+    public TieredMemoryPool<MemoryPoolRuntimeTier, page_size, page_count>
+{
+    typedef TieredMemoryPool<MemoryPoolRuntimeTier, page_size, page_count> base_t;
+
+public:
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+
+    // pick up span allocate and pool to pool copy
+    using base_t::allocate;
+    using base_t::copy;
+
+    /// @param directory_pages # of pages reserved for handles.  More than one lets
+    /// pools with many small allocations track more handles than page 0 holds
+    MemoryPool(TierEnum tier = Indexed, uint8_t directory_pages = 1) :
+        base_t(tier, directory_pages)
+    {
+    }
+
+    virtual handle_opaque_t allocate(size_t size) OVERRIDE
+    {
+        return base_t::allocate(size);
+    }
+
+    virtual handle_opaque_t allocate(const void* data, size_t size, size_t size_copy) OVERRIDE
+    {
+        return base_t::allocate(data, size, size_copy);
+    }
+
+    virtual bool free(handle_opaque_t handle) OVERRIDE
+    {
+        return base_t::free(handle);
+    }
+
+    virtual bool expand(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        return base_t::expand(handle, size);
+    }
+
+    virtual void shrink(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        base_t::shrink(handle, size);
+    }
+
+    virtual handle_opaque_t copy(handle_opaque_t copy_from, size_t size, size_t size_copy) OVERRIDE
+    {
+        return base_t::copy(copy_from, size, size_copy);
+    }
+
+    virtual void* lock(handle_opaque_t handle) OVERRIDE
+    {
+        return base_t::lock(handle);
+    }
+
+    virtual void unlock(handle_opaque_t handle) OVERRIDE
+    {
+        base_t::unlock(handle);
+    }
+};
+
+
+// Pool over a caller supplied span of page_count * page_size bytes, such as
+// a memory mapped file.  Handle directory and page headers refer to pages by
+// number only, so the span may be saved, shared or mapped at a different
+// address and reopened later as-is.  initialize() records page_size and
+// page_count in the directory, so open() refuses spans of any other geometry.
+// Usage counters are per instance, and get rebuilt on open().  Processes
+// sharing one span must synchronize writers themselves
+template <class TTier, size_t page_size = 32, uint8_t page_count = 128>
+class ExternalMemoryPool : public TieredMemoryPool<TTier, page_size, page_count, true>
+{
+    typedef TieredMemoryPool<TTier, page_size, page_count, true> base_t;
+    typedef typename MemoryPoolPages<page_size, page_count, true>::type pages_t;
+
+public:
+    typedef TTier tier_t;
+
+    /// bytes of span required
+    static CONSTEXPR size_t span_size() { return page_size * page_count; }
+
+    /// NOTE: does not touch span.  Follow up with initialize() or open()
+    ExternalMemoryPool(void* span) :
+        base_t(typename base_t::deferred_initialize_t())
+    {
+        this->pages = (pages_t)span;
+    }
+
+    /// Formats span as a fresh, empty pool, recording its geometry for open()
+    void initialize(uint8_t directory_pages = 1)
+    {
+        base_t::format(directory_pages);
+    }
+
+    /// Formats span as a fresh, empty pool of the given tier (MemoryPoolRuntimeTier)
+    void initialize(IMemory::TierEnum tier, uint8_t directory_pages)
+    {
+        base_t::format(tier, directory_pages);
+    }
+
+    /// Adopts a span previously formatted by initialize()
+    /// @return false if span doesn't hold a pool of this geometry and of a tier
+    /// we can operate on
+    bool open()
+    {
+        return base_t::adopt();
+    }
+};
+
+
+// Indexed2 pool whose geometry is decided at runtime rather than by template,
+// over caller supplied memory.  TIndex is the width of page numbers and run
+// sizes within the directory, so uint16_t or uint32_t lift the 255 page cap
+// MemoryPool has.  Otherwise the same pool as TieredMemoryPool's Indexed2 tier,
+// stats and allocate_n included.  open() accepts MemoryPool spans formatted by
+// ExternalMemoryPool when TIndex is uint8_t and geometry matches
+template <class TIndex = uint16_t>
+class RuntimeMemoryPool :
+    public TieredMemoryPoolT<MemoryPoolIndexed2Tier, MemoryPoolRuntimeGeometry<TIndex> >
+{
+    typedef MemoryPoolRuntimeGeometry<TIndex> geometry_t;
+    typedef TieredMemoryPoolT<MemoryPoolIndexed2Tier, geometry_t> base_t;
+
+    // noncopyable
+    RuntimeMemoryPool(const RuntimeMemoryPool&);
+    RuntimeMemoryPool& operator=(const RuntimeMemoryPool&);
+
+public:
+    /// NOTE: does not touch span.  Follow up with initialize() or open()
+    /// @param span_size bytes of span.  Pages beyond what TIndex can number are left unused
+    RuntimeMemoryPool(void* span, size_t span_size, size_t page_size = 32) :
+        base_t(geometry_t(span, span_size, page_size))
+    {
+        ASSERT_ERROR(true, page_size > sizeof(typename base_t::page_data_t), "page_size too small");
+    }
+
+    size_t get_page_size() const { return base_t::page_size(); }
+    size_t get_page_count() const { return base_t::page_count(); }
+
+    /// Formats span as a fresh, empty pool, recording its geometry for open()
+    /// @param directory_pages # of pages reserved for handles
+    void initialize(uint8_t directory_pages = 1)
+    {
+        base_t::format(directory_pages);
+    }
+
+    /// Adopts a span previously formatted by initialize()
+    /// @return false if span doesn't hold an Indexed2 pool of this geometry
+    bool open()
+    {
+        return base_t::adopt();
+    }
+};
+
+
+// Thin IMemory face over a TieredMemoryPool (or anything with the same
+// non-virtual interface), for where a fixed tier pool must be handed to
+// IMemory consumers
+template <class TPool>
+class IMemoryAdapter : public IMemory
+{
+    TPool& pool;
+
+public:
+    IMemoryAdapter(TPool& pool) : pool(pool) {}
+
+    virtual handle_opaque_t allocate(size_t size) OVERRIDE
+    {
+        return pool.allocate(size);
+    }
+
+    virtual handle_opaque_t allocate(const void* data, size_t size, size_t size_copy) OVERRIDE
+    {
+        return pool.allocate(data, size, size_copy);
+    }
+
+    virtual bool free(handle_opaque_t handle) OVERRIDE
+    {
+        return pool.free(handle);
+    }
+
+    virtual bool expand(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        return pool.expand(handle, size);
+    }
+
+    virtual void shrink(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        pool.shrink(handle, size);
+    }
+
+    virtual handle_opaque_t copy(handle_opaque_t copy_from, size_t size, size_t size_copy) OVERRIDE
+    {
+        return pool.copy(copy_from, size, size_copy);
+    }
+
+    virtual void* lock(handle_opaque_t handle) OVERRIDE
+    {
+        return pool.lock(handle);
+    }
+
+    virtual void unlock(handle_opaque_t handle) OVERRIDE
+    {
+        pool.unlock(handle);
+    }
+};
+
+
+// Size class allocator over four MemoryPools of increasing page size.  Each
+// request goes to the smallest class whose single page holds it, or the
+// largest class when none does, spilling over into larger classes if
+// that one is full.  Class # lives in the top class_bits of the handle
+template <size_t page_size0 = 16, size_t page_size1 = 32, size_t page_size2 = 64,
+          size_t page_size3 = 256, uint8_t page_count = 128>
+class MemoryPoolAggregator : public IMemory
+{
+public:
+    enum
+    {
+        class_count = 4,
+        class_bits = 2,
+        class_shift = sizeof(handle_opaque_t) * 8 - class_bits
+    };
+
+private:
+    MemoryPool<page_size0, page_count> pool0;
+    MemoryPool<page_size1, page_count> pool1;
+    MemoryPool<page_size2, page_count> pool2;
+    MemoryPool<page_size3, page_count> pool3;
+
+    TierEnum tier;
+
+    IMemory& get_pool(uint8_t size_class)
+    {
+        switch(size_class)
+        {
+            case 0: return pool0;
+            case 1: return pool1;
+            case 2: return pool2;
+            default: return pool3;
+        }
+    }
+
+    static size_t get_page_size(uint8_t size_class)
+    {
+        switch(size_class)
+        {
+            case 0: return page_size0;
+            case 1: return page_size1;
+            case 2: return page_size2;
+            default: return page_size3;
+        }
+    }
+
+    static handle_opaque_t inner_mask()
+    {
+        return ((handle_opaque_t)1 << class_shift) - 1;
+    }
+
+    static handle_opaque_t get_inner(handle_opaque_t handle)
+    {
+        return handle & inner_mask();
+    }
+
+    // tags class c's own handle h with c.  h too wide to leave room for the
+    // tag is freed again, since all ones within class 3 would read back as
+    // invalid_handle
+    handle_opaque_t encode(uint8_t c, handle_opaque_t h)
+    {
+        if(h == invalid_handle) return h;
+
+        if(h >= inner_mask())
+        {
+            ASSERT_WARN(true, false, "underlying handle too wide for size class");
+            get_pool(c).free(h);
+            return invalid_handle;
+        }
+
+        return ((handle_opaque_t)c << class_shift) | h;
+    }
+
+public:
+    MemoryPoolAggregator(TierEnum tier = Indexed2) :
+        pool0(tier), pool1(tier), pool2(tier), pool3(tier),
+        tier(tier)
+    {}
+
+    static uint8_t get_handle_class(handle_opaque_t handle)
+    {
+        return handle >> class_shift;
+    }
+
+    /// smallest class whose single page fits size bytes
+    uint8_t get_size_class(size_t size) const
+    {
+        // Indexed2 carves its PageData out of the first page
+        if(tier == Indexed2) size += sizeof(MemoryPoolIndexed2HandlePage::handle_t::PageData);
+
+        for(uint8_t c = 0; c < class_count - 1; c++)
+            if(size <= get_page_size(c)) return c;
+
+        return class_count - 1;
+    }
+
+    virtual handle_opaque_t allocate(size_t size) OVERRIDE
+    {
+        for(uint8_t c = get_size_class(size); c < class_count; c++)
+        {
+            handle_opaque_t h = encode(c, get_pool(c).allocate(size));
+
+            if(h != invalid_handle) return h;
+        }
+
+        return invalid_handle;
+    }
+
+    virtual handle_opaque_t allocate(const void* data, size_t size, size_t size_copy = 0) OVERRIDE
+    {
+        handle_opaque_t h = allocate(size);
+
+        if(h == invalid_handle) return h;
+
+        if(size_copy == 0) size_copy = size;
+
+        memcpy(lock(h), data, size_copy);
+        unlock(h);
+
+        return h;
+    }
+
+    virtual bool free(handle_opaque_t handle) OVERRIDE
+    {
+        if(handle == invalid_handle) return false;
+
+        return get_pool(get_handle_class(handle)).free(get_inner(handle));
+    }
+
+    /// Grows within handle's own class, since handle must stay the same
+    virtual bool expand(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        if(handle == invalid_handle) return false;
+
+        return get_pool(get_handle_class(handle)).expand(get_inner(handle), size);
+    }
+
+    virtual void shrink(handle_opaque_t handle, size_t size) OVERRIDE
+    {
+        if(handle == invalid_handle) return;
+
+        get_pool(get_handle_class(handle)).shrink(get_inner(handle), size);
+    }
+
+    /// Copies within handle's own class pool, page to page
+    virtual handle_opaque_t copy(handle_opaque_t copy_from, size_t size, size_t size_copy) OVERRIDE
+    {
+        if(copy_from == invalid_handle) return invalid_handle;
+
+        uint8_t c = get_handle_class(copy_from);
+
+        return encode(c, get_pool(c).copy(get_inner(copy_from), size, size_copy));
+    }
+
+    virtual void* lock(handle_opaque_t handle) OVERRIDE
+    {
+        if(handle == invalid_handle) return NULLPTR;
+
+        return get_pool(get_handle_class(handle)).lock(get_inner(handle));
+    }
+
+    virtual void unlock(handle_opaque_t handle) OVERRIDE
+    {
+        if(handle == invalid_handle) return;
+
+        get_pool(get_handle_class(handle)).unlock(get_inner(handle));
+    }
+
+    /// Free bytes summed across all classes
+    size_t get_free() const
+    {
+        return pool0.get_free() + pool1.get_free() + pool2.get_free() + pool3.get_free();
+    }
 };
 
 }}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "mem/platform.h"
+#include "objstack.h"
+
+#ifdef __CPP11__
+#include <atomic>
+#include <new>
+#endif
+
+namespace moducom { namespace dynamic {
+
+#ifdef __CPP11__
+
+// Fixed set of ObjStacks carved out of one caller supplied region, sized at
+// startup, each handed to at most one thread at a time.  A thread's arena is
+// claimed on first use of local() and given back, emptied, when the thread
+// exits or calls release()
+//
+// Region layout is count slices, each a cache line aligned header holding
+// the ObjStack followed by arena_size bytes (rounded up to whole lines) of
+// scratch space, so neighboring threads never share a line
+//
+// NOTE: a thread holds an arena of at most one ObjStackArenas at a time.
+// The others hand it none until it calls release().  Each ObjStackArenas
+// must outlive the threads using it
+class ObjStackArenas
+{
+    struct Slot
+    {
+        std::atomic_flag claimed;
+        ObjStack stack;
+
+        Slot(const pipeline::MemoryChunk& chunk) : stack(chunk)
+        {
+            claimed.clear();
+        }
+    };
+
+    // releases calling thread's arena as thread exits
+    struct Binding
+    {
+        ObjStackArenas* owner;
+        Slot* slot;
+
+        ~Binding()
+        {
+            if(slot != NULLPTR) owner->unbind(*this);
+        }
+    };
+
+    uint8_t* const region;
+    const size_t scratch_size;
+    const size_t count;
+
+    static size_t round_up(size_t size)
+    {
+        const size_t line = ObjStack::cache_line_size();
+
+        return (size + line - 1) & ~(line - 1);
+    }
+
+    static size_t header_size() { return round_up(sizeof(Slot)); }
+
+    // no destructor, so access needs no guard - just a TLS load
+    static ObjStack*& current_stack()
+    {
+        static thread_local ObjStack* stack = NULLPTR;
+
+        return stack;
+    }
+
+    // ObjStackArenas current_stack() belongs to, same reasoning
+    static ObjStackArenas*& current_owner()
+    {
+        static thread_local ObjStackArenas* owner = NULLPTR;
+
+        return owner;
+    }
+
+    static Binding& binding()
+    {
+        static thread_local Binding b = { NULLPTR, NULLPTR };
+
+        return b;
+    }
+
+    Slot& slot(size_t i) const
+    {
+        return *(Slot*)(region + i * slice_size(scratch_size));
+    }
+
+    void unbind(Binding& b)
+    {
+        Slot& s = *b.slot;
+
+        // empty arena for its next owner
+        s.stack.rewind((uint8_t*)&s + header_size());
+
+        b.slot = NULLPTR;
+        b.owner = NULLPTR;
+        current_stack() = NULLPTR;
+        current_owner() = NULLPTR;
+
+        s.claimed.clear(std::memory_order_release);
+    }
+
+public:
+    /// bytes of region taken per arena of arena_size bytes
+    static size_t slice_size(size_t arena_size)
+    {
+        return header_size() + round_up(arena_size);
+    }
+
+    /// bytes of region needed for count arenas of arena_size bytes
+    static size_t region_size(size_t arena_size, size_t count)
+    {
+        return slice_size(arena_size) * count;
+    }
+
+    /// @param region at least region_size(arena_size, count) bytes, ideally cache
+    /// line aligned.  A PageRegion, to place arenas on huge pages or a NUMA node
+    ObjStackArenas(void* region, size_t arena_size, size_t count) :
+        region((uint8_t*)region),
+        scratch_size(round_up(arena_size)),
+        count(count)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            uint8_t* slice = this->region + i * slice_size(scratch_size);
+
+            new (slice) Slot(pipeline::MemoryChunk(slice + header_size(), scratch_size));
+        }
+    }
+
+    size_t arena_count() const { return count; }
+    size_t arena_size() const { return scratch_size; }
+
+    /// Claims a free arena for calling thread, or returns the one it already has
+    /// @return NULLPTR if all arenas are taken, or thread holds one of other arenas
+    ObjStack* acquire()
+    {
+        Binding& b = binding();
+
+        if(b.slot != NULLPTR)
+            return b.owner == this ? &b.slot->stack : NULLPTR;
+
+        for(size_t i = 0; i < count; i++)
+        {
+            Slot& s = slot(i);
+
+            if(s.claimed.test_and_set(std::memory_order_acquire)) continue;
+
+            b.owner = this;
+            b.slot = &s;
+            current_stack() = &s.stack;
+            current_owner() = this;
+
+            return &s.stack;
+        }
+
+        return NULLPTR;
+    }
+
+    /// Empties calling thread's arena and makes it available to other threads
+    void release()
+    {
+        Binding& b = binding();
+
+        if(b.slot != NULLPTR && b.owner == this) unbind(b);
+    }
+
+    /// Calling thread's arena, claimed on first use
+    /// @return NULLPTR if thread has none and all arenas are taken, or thread
+    /// holds one of other arenas
+    ObjStack* local()
+    {
+        if(current_owner() == this) return current_stack();
+
+        return acquire();
+    }
+
+    /// Arena calling thread presently holds, without claiming one
+    static ObjStack* current() { return current_stack(); }
+};
+
+
+// Allocator over an ObjStack, by default the calling thread's arena, usable
+// with std and estd containers.  Allocation is monotonic: deallocate() is a
+// no-op and memory comes back when the stack is rewound, i.e. by a scope
+// around the container's lifetime
+template <class T, class TStack = ObjStack>
+class ObjStackAllocator
+{
+    template <class U, class TStack2>
+    friend class ObjStackAllocator;
+
+    TStack* stack;
+
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    // estd handle flavor, where handle and pointer are one and the same
+    typedef T* handle_type;
+    typedef const void* const_void_pointer;
+
+    template <class U>
+    struct rebind
+    {
+        typedef ObjStackAllocator<U, TStack> other;
+    };
+
+    /// binds to calling thread's ObjStackArenas arena, which must already be claimed
+    ObjStackAllocator() : stack(ObjStackArenas::current())
+    {
+        ASSERT_ERROR(true, stack != NULLPTR, "no arena claimed by this thread");
+    }
+
+    ObjStackAllocator(TStack& stack) : stack(&stack) {}
+
+    template <class U>
+    ObjStackAllocator(const ObjStackAllocator<U, TStack>& copy_from) : stack(copy_from.stack) {}
+
+    TStack& get_stack() const { return *stack; }
+
+    static CONSTEXPR handle_type invalid() { return NULLPTR; }
+
+    /// @return storage for n T's, aligned for T
+    T* allocate(size_t n)
+    {
+        void* p = stack->alloc(n * sizeof(T), ObjStack::alignment_of<T>());
+
+#if __cpp_exceptions
+        if(p == NULLPTR) throw std::bad_alloc();
+#endif
+
+        return (T*)p;
+    }
+
+    void deallocate(T*, size_t) {}
+
+    T* lock(handle_type h) { return h; }
+    void unlock(handle_type) {}
+
+    template <class U>
+    bool operator==(const ObjStackAllocator<U, TStack>& compare_to) const
+    {
+        return stack == compare_to.stack;
+    }
+
+    template <class U>
+    bool operator!=(const ObjStackAllocator<U, TStack>& compare_to) const
+    {
+        return stack != compare_to.stack;
+    }
+};
+
+#endif
+
+}}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "memory-chunk.h"
+#include "memory.h"
 
 // Adds extra metadata in objstack allocations for runtime
 // sanity checks
@@ -9,8 +10,35 @@
 // Performs free operations by basically moving m_data pointer directly
 #define FEATURE_MC_MEM_OBJSTACK_GNUSTYLE
 
+// Line size ObjStack::alloc_cache_line() aligns and pads to.  Override for
+// targets with other than 64 byte lines
+#ifndef MC_MEM_CACHE_LINE_SIZE
+#define MC_MEM_CACHE_LINE_SIZE 64
+#endif
+
+#include <new>
+
+#ifdef __CPP11__
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#endif
+
 namespace moducom { namespace dynamic {
 
+template <class TStack>
+class ObjStackScope;
+
+#ifndef __CPP11__
+// offset of t is alignment of T, for want of alignof
+template <class T>
+struct ObjStackAlignmentProbe
+{
+    char c;
+    T t;
+};
+#endif
+
 // TODO: split this out into layer varieties
 // TODO: adapt to utilize IMemory, if we can
 // TODO: Consider renaming to ObStack as that's the semi-proper gnu term
@@ -21,16 +49,35 @@ class ObjStack : public pipeline::MemoryChunk
     typedef pipeline::MemoryChunk memory_chunk_t;
 
     //memory_chunk_t memory_chunk;
+protected:
 #ifdef FEATURE_MC_MEM_OBJSTACK_CHECK
     size_t max_length;
 #endif
 
+    /// Repoints stack at a different chunk of memory, as segmented stacks do
+    /// when they move between segments
+    void rebase(uint8_t* data, size_t length)
+    {
+        m_data = data;
+        m_length = length;
+    }
+
 public:
     struct Descriptor
     {
         size_t size;
     };
 
+    /// bytes consumed per allocation beyond the allocation itself
+    static CONSTEXPR size_t overhead()
+    {
+#ifdef FEATURE_MC_MEM_OBJSTACK_CHECK
+        return sizeof(Descriptor);
+#else
+        return 0;
+#endif
+    }
+
 public:
     ObjStack(const memory_chunk_t& memory_chunk) :
         memory_chunk_t(memory_chunk)
@@ -40,12 +87,16 @@ public:
 #endif
     }
 
-    void* alloc(size_t size)
+protected:
+    // places descriptor (if any) and object at m_data, no questions asked
+    void* bump(size_t size)
     {
-        // TODO: Asserts
-
 #ifdef FEATURE_MC_MEM_OBJSTACK_CHECK
-        ((Descriptor*)m_data)->size = size;
+        Descriptor descriptor;
+
+        descriptor.size = size;
+        // packed right up against object, so it's only as aligned as object is
+        ::memcpy(m_data, &descriptor, sizeof(Descriptor));
         m_data += sizeof(Descriptor);
         m_length -= sizeof(Descriptor);
 #endif
@@ -57,6 +108,103 @@ public:
         return d;
     }
 
+    /// bytes to skip so that object, which follows descriptor, lands on align
+    size_t padding(size_t align) const
+    {
+        size_t misalignment = ((uintptr_t)m_data + overhead()) & (align - 1);
+
+        return misalignment == 0 ? 0 : align - misalignment;
+    }
+
+public:
+    template <class T>
+    static CONSTEXPR size_t alignment_of()
+    {
+#ifdef __CPP11__
+        return alignof(T);
+#else
+        return sizeof(ObjStackAlignmentProbe<T>) - sizeof(T);
+#endif
+    }
+
+    /// strictest alignment of any fundamental type
+    static CONSTEXPR size_t max_alignment()
+    {
+#ifdef __CPP11__
+        return alignof(std::max_align_t);
+#else
+        return alignment_of<long double>();
+#endif
+    }
+
+    /// Strictest alignment any type size bytes large can have, as a type's
+    /// size is always a multiple of its alignment.  For where only size is
+    /// known, i.e. placement new
+    static size_t alignment_for_size(size_t size)
+    {
+        // lowest set bit
+        const size_t align = size & (~size + 1);
+
+        return align == 0 || align > max_alignment() ? max_alignment() : align;
+    }
+
+    static CONSTEXPR size_t cache_line_size() { return MC_MEM_CACHE_LINE_SIZE; }
+
+    /// Allocates with no alignment at all, packing objects byte to byte
+    /// @return NULLPTR if size bytes (plus overhead) don't fit in what remains
+    void* alloc(size_t size)
+    {
+        if(m_length < overhead() || size > m_length - overhead()) return NULLPTR;
+
+        return bump(size);
+    }
+
+    /// @param align power of two.  Skipped padding is only recovered once
+    /// an allocation made before this one is freed
+    /// @return NULLPTR if size bytes (plus overhead and padding) don't fit
+    void* alloc(size_t size, size_t align)
+    {
+        ASSERT(true, align != 0 && (align & (align - 1)) == 0);
+
+        const size_t skip = padding(align) + overhead();
+
+        if(m_length < skip || size > m_length - skip) return NULLPTR;
+
+        m_data += skip - overhead();
+        m_length -= skip - overhead();
+
+        return bump(size);
+    }
+
+    /// Storage suitably aligned for a T, i.e. new (os.alloc<T>()) T(...)
+    template <class T>
+    void* alloc()
+    {
+        return alloc(sizeof(T), alignment_of<T>());
+    }
+
+    /// Starts allocation on a cache line and pads it out to whole lines, so
+    /// nothing allocated afterwards shares a line with it
+    void* alloc_cache_line(size_t size)
+    {
+        const size_t line = cache_line_size();
+
+        return alloc((size + line - 1) & ~(line - 1), line);
+    }
+
+    typedef ObjStackScope<ObjStack> scope;
+
+    /// Present top of stack, for handing back to rewind()
+    uint8_t* position() const { return m_data; }
+
+    /// Releases everything allocated since position was taken.  Destructors
+    /// aren't run, see scope for that
+    void rewind(uint8_t* position)
+    {
+        m_length += m_data - position;
+        m_data = position;
+    }
+
 
 #ifdef FEATURE_MC_MEM_OBJSTACK_GNUSTYLE
     void free(void* objstack_ptr)
@@ -79,7 +227,10 @@ public:
         // ESP_IDF generates a bazillion warnings and we don't inspect this
         // in that environment anyway
 #ifndef ESP_PLATFORM
-        size_t sanity_check_size = ((Descriptor*)m_data)->size;
+        Descriptor descriptor;
+
+        ::memcpy(&descriptor, m_data, sizeof(Descriptor));
+        size_t sanity_check_size = descriptor.size;
 #endif
 
 #endif
@@ -102,7 +253,10 @@ public:
 #ifdef FEATURE_MC_MEM_OBJSTACK_CHECK
         m_data -= sizeof(Descriptor);
         m_length += sizeof(Descriptor);
-        size_t sanity_check_size = ((Descriptor*)m_data)->size;
+        Descriptor descriptor;
+
+        ::memcpy(&descriptor, m_data, sizeof(Descriptor));
+        size_t sanity_check_size = descriptor.size;
 #endif
     }
 
@@ -124,12 +278,438 @@ public:
 };
 
 
+// Segment source backed by an IMemory.  Each segment stays locked for as long
+// as it's in use, since the objects on it are referred to by pointer, and
+// carries its handle just ahead of the segment handed out
+class IMemorySegmentProvider
+{
+    typedef IMemory::handle_opaque_t handle_opaque_t;
+
+    IMemory& memory;
+
+public:
+    IMemorySegmentProvider(IMemory& memory) : memory(memory) {}
+
+    /// @param actual receives usable size of segment, at least size
+    /// @return segment aligned to ObjStack::max_alignment(), or NULLPTR if
+    /// memory is exhausted
+    void* allocate(size_t size, size_t* actual)
+    {
+        const size_t align = ObjStack::max_alignment();
+        // room for handle, plus worst case padding since IMemory guarantees no alignment
+        handle_opaque_t handle = memory.allocate(size + sizeof(handle_opaque_t) + align - 1);
+
+        if(handle == IMemory::invalid_handle) return NULLPTR;
+
+        uintptr_t base = (uintptr_t)memory.lock(handle) + sizeof(handle_opaque_t);
+        uint8_t* segment = (uint8_t*)((base + align - 1) & ~(uintptr_t)(align - 1));
+
+        ::memcpy(segment - sizeof(handle_opaque_t), &handle, sizeof(handle_opaque_t));
+        *actual = size;
+
+        return segment;
+    }
+
+    void free(void* segment)
+    {
+        handle_opaque_t handle;
+
+        ::memcpy(&handle, (uint8_t*)segment - sizeof(handle_opaque_t), sizeof(handle_opaque_t));
+
+        memory.unlock(handle);
+        memory.free(handle);
+    }
+};
+
+
+// Segment source handing out the value area of nodes of a fixed node pool,
+// such as LinkedListPool3 or ConcurrentLinkedListPool3.  Segments are always
+// one value large, so allocations bigger than that can't be satisfied
+template <class TPool>
+class PoolSegmentProvider
+{
+    typedef typename TPool::node_t node_t;
+    typedef typename TPool::value_type value_type;
+
+    TPool& pool;
+
+public:
+    PoolSegmentProvider(TPool& pool) : pool(pool) {}
+
+    void* allocate(size_t size, size_t* actual)
+    {
+        if(size > sizeof(value_type)) return NULLPTR;
+
+        node_t* node = pool.alloc();
+
+        if(node == NULLPTR) return NULLPTR;
+
+        *actual = sizeof(value_type);
+
+        // free list link is left alone, concurrent pools may still be reading it
+        return &node->value;
+    }
+
+    void free(void* segment)
+    {
+        pool.free(TPool::node_of((value_type*)segment));
+    }
+};
+
+
+#ifdef FEATURE_MC_MEM_OBJSTACK_GNUSTYLE
+// ObjStack which, once its present chunk fills, chains on another segment
+// taken from TProvider.  Allocation remains a bump of the pointer until a
+// segment runs out.  Freeing back past the start of a segment hands that
+// segment back to TProvider
+//
+// TProvider needs:
+//   void* allocate(size_t size, size_t* actual), aligned for a pointer at least
+//   void free(void* segment)
+//
+// ObjStack is a private base, as its alloc/free/rewind aren't virtual and
+// would bypass segment chaining if reached through an ObjStack&
+template <class TProvider>
+class SegmentedObjStack : private ObjStack
+{
+    // lives at the start of each segment
+    struct Segment
+    {
+        Segment* prev;
+        uint8_t* end;
+
+        uint8_t* begin() { return (uint8_t*)(this + 1); }
+    };
+
+    TProvider& provider;
+    const size_t segment_size;
+    // NULLPTR while still within initial chunk
+    Segment* current;
+    // initial chunk, which isn't ours to free
+    uint8_t* const initial_begin;
+    uint8_t* const initial_end;
+
+    // noncopyable
+    SegmentedObjStack(const SegmentedObjStack&);
+    SegmentedObjStack& operator=(const SegmentedObjStack&);
+
+    bool grow(size_t size)
+    {
+        size_t needed = sizeof(Segment) + overhead() + size;
+        size_t actual;
+
+        void* raw = provider.allocate(needed > segment_size ? needed : segment_size, &actual);
+
+        if(raw == NULLPTR) return false;
+
+        Segment* segment = (Segment*)raw;
+
+        segment->prev = current;
+        segment->end = (uint8_t*)raw + actual;
+        current = segment;
+
+        rebase(segment->begin(), actual - sizeof(Segment));
+
+        return true;
+    }
+
+    // moves back to preceding segment (or initial chunk), as if it were full
+    void pop()
+    {
+        Segment* segment = current;
+
+        current = segment->prev;
+        provider.free(segment);
+
+        rebase(current == NULLPTR ? initial_end : current->end, 0);
+    }
+
+    bool in_current(const uint8_t* p) const
+    {
+        if(current == NULLPTR) return true;
+
+        return p >= current->begin() && p <= current->end;
+    }
+
+public:
+    /// @param segment_size minimum size, header included, requested of provider per segment
+    /// @param chunk initial memory, used before any segment is taken.  May be empty
+    SegmentedObjStack(TProvider& provider, size_t segment_size,
+                      const pipeline::MemoryChunk& chunk = pipeline::MemoryChunk(NULLPTR, 0)) :
+        ObjStack(chunk),
+        provider(provider),
+        segment_size(segment_size),
+        current(NULLPTR),
+        initial_begin(chunk.data()),
+        initial_end(chunk.data() + chunk.length())
+    {}
+
+    ~SegmentedObjStack() { clear(); }
+
+    using ObjStack::Descriptor;
+    using ObjStack::overhead;
+    using ObjStack::alignment_of;
+    using ObjStack::max_alignment;
+    using ObjStack::alignment_for_size;
+    using ObjStack::cache_line_size;
+    using ObjStack::position;
+    using ObjStack::available;
+
+    void* alloc(size_t size)
+    {
+        void* d = ObjStack::alloc(size);
+
+        if(d != NULLPTR) return d;
+
+        if(!grow(size)) return NULLPTR;
+
+        return ObjStack::alloc(size);
+    }
+
+    void* alloc(size_t size, size_t align)
+    {
+        void* d = ObjStack::alloc(size, align);
+
+        if(d != NULLPTR) return d;
+
+        // worst case padding in new segment
+        if(!grow(size + align - 1)) return NULLPTR;
+
+        return ObjStack::alloc(size, align);
+    }
+
+    template <class T>
+    void* alloc()
+    {
+        return alloc(sizeof(T), alignment_of<T>());
+    }
+
+    void* alloc_cache_line(size_t size)
+    {
+        const size_t line = cache_line_size();
+
+        return alloc((size + line - 1) & ~(line - 1), line);
+    }
+
+    /// Rewinds to objstack_ptr, returning any segments allocated after it.  A
+    /// segment rewound exactly to its start is kept, so a stack hovering at a
+    /// boundary doesn't take and return a segment on every allocation
+    void free(void* objstack_ptr)
+    {
+        // descriptor, if any, sits in same segment as object
+        const uint8_t* p = (const uint8_t*)objstack_ptr - overhead();
+
+        while(!in_current(p)) pop();
+
+        ObjStack::free(objstack_ptr);
+    }
+
+    template <class T>
+    inline void del(T* t)
+    {
+        t->~T();
+        free(t);
+    }
+
+    typedef ObjStackScope<SegmentedObjStack> scope;
+
+    /// Releases everything allocated since position was taken, returning
+    /// segments chained on since then
+    void rewind(uint8_t* position)
+    {
+        while(!in_current(position)) pop();
+
+        ObjStack::rewind(position);
+    }
+
+    /// Returns every segment to provider and rewinds to start of initial chunk
+    void clear()
+    {
+        while(current != NULLPTR) pop();
+
+        rebase(initial_begin, initial_end - initial_begin);
+    }
+
+    /// # of segments presently chained on
+    size_t segment_count() const
+    {
+        size_t count = 0;
+
+        for(Segment* s = current; s != NULLPTR; s = s->prev) count++;
+
+        return count;
+    }
+};
+#endif
+
+
+
+
+// Marks TStack's position on construction and rewinds to it on destruction,
+// releasing everything allocated in between with a single rewind.  Objects
+// made through create() additionally have their destructors run first, in
+// reverse order of creation.  Their bookkeeping lives on TStack too, and
+// trivially destructible objects need none
+//
+// NOTE: don't free() TStack back past objects created in a scope which is
+// still open
+template <class TStack>
+class ObjStackScope
+{
+    struct Finalizer
+    {
+        Finalizer* next;
+        void (*destroy)(void* object);
+        void* object;
+    };
+
+    TStack& stack;
+    uint8_t* const mark;
+    // most recently registered first
+    Finalizer* finalizers;
+
+    // noncopyable
+    ObjStackScope(const ObjStackScope&);
+    ObjStackScope& operator=(const ObjStackScope&);
+
+    template <class T>
+    static void destroy(void* object)
+    {
+        ((T*)object)->~T();
+    }
+
+    template <class T>
+    static bool needs_finalizer()
+    {
+#ifdef __CPP11__
+        return !std::is_trivially_destructible<T>::value;
+#else
+        return true;
+#endif
+    }
+
+    /// Storage for a T plus its Finalizer, if it needs one
+    /// @return NULLPTR, with stack untouched, if either doesn't fit
+    template <class T>
+    void* reserve(Finalizer** finalizer)
+    {
+        uint8_t* before = stack.position();
+
+        *finalizer = NULLPTR;
+
+        if(needs_finalizer<T>())
+        {
+            *finalizer = (Finalizer*)stack.template alloc<Finalizer>();
+
+            if(*finalizer == NULLPTR) return NULLPTR;
+        }
+
+        void* storage = stack.template alloc<T>();
+
+        if(storage == NULLPTR) stack.rewind(before);
+
+        return storage;
+    }
+
+    template <class T>
+    T* track(T* object, Finalizer* finalizer)
+    {
+        if(finalizer != NULLPTR)
+        {
+            finalizer->next = finalizers;
+            finalizer->destroy = &destroy<T>;
+            finalizer->object = object;
+            finalizers = finalizer;
+        }
+
+        return object;
+    }
+
+public:
+    ObjStackScope(TStack& stack) :
+        stack(stack),
+        mark(stack.position()),
+        finalizers(NULLPTR)
+    {}
+
+    ~ObjStackScope()
+    {
+        for(Finalizer* f = finalizers; f != NULLPTR; f = f->next)
+            f->destroy(f->object);
+
+        stack.rewind(mark);
+    }
+
+    /// Constructs a T on stack, to be destroyed when scope exits
+    /// @return NULLPTR if stack is out of room
+#ifdef __CPP11__
+    template <class T, class ...TArgs>
+    T* create(TArgs&&...args)
+    {
+        Finalizer* finalizer;
+        void* storage = reserve<T>(&finalizer);
+
+        if(storage == NULLPTR) return NULLPTR;
+
+        return track(new (storage) T(std::forward<TArgs>(args)...), finalizer);
+    }
+#else
+    template <class T>
+    T* create()
+    {
+        Finalizer* finalizer;
+        void* storage = reserve<T>(&finalizer);
+
+        if(storage == NULLPTR) return NULLPTR;
+
+        return track(new (storage) T(), finalizer);
+    }
+
+    template <class T, class TArg1>
+    T* create(const TArg1& arg1)
+    {
+        Finalizer* finalizer;
+        void* storage = reserve<T>(&finalizer);
+
+        if(storage == NULLPTR) return NULLPTR;
+
+        return track(new (storage) T(arg1), finalizer);
+    }
+#endif
+};
+
 }}
 
+// aligned as strictly as any type of sz bytes could need, so new (os) T is
+// always aligned for T.  See ObjStack::alloc(size) for byte packed storage
 inline void* operator new(size_t sz, moducom::dynamic::ObjStack& os)
 {
-    return os.alloc(sz);
+    return os.alloc(sz, moducom::dynamic::ObjStack::alignment_for_size(sz));
+}
+
+#ifdef FEATURE_MC_MEM_OBJSTACK_GNUSTYLE
+template <class TProvider>
+inline void* operator new(size_t sz, moducom::dynamic::SegmentedObjStack<TProvider>& os)
+{
+    return os.alloc(sz, moducom::dynamic::ObjStack::alignment_for_size(sz));
+}
+#endif
+
+#if __cpp_aligned_new
+// picked by new (os) T whenever T is over-aligned
+inline void* operator new(size_t sz, std::align_val_t al, moducom::dynamic::ObjStack& os)
+{
+    return os.alloc(sz, (size_t)al);
+}
+
+#ifdef FEATURE_MC_MEM_OBJSTACK_GNUSTYLE
+template <class TProvider>
+inline void* operator new(size_t sz, std::align_val_t al, moducom::dynamic::SegmentedObjStack<TProvider>& os)
+{
+    return os.alloc(sz, (size_t)al);
 }
+#endif
+#endif
 
 
 #if defined(FEATURE_MC_MEM_OBJSTACK_CHECK) && !defined(FEATURE_MC_MEM_OBJSTACK_GNUSTYLE)
@@ -139,9 +719,11 @@ inline void operator delete(void* ptr, moducom::dynamic::ObjStack& os)
 {
     typedef moducom::dynamic::ObjStack::Descriptor descriptor_t;
 
-    size_t size = ((descriptor_t*)((uint8_t*)ptr) - sizeof(descriptor_t))->size;
+    descriptor_t descriptor;
+
+    memcpy(&descriptor, (uint8_t*)ptr - sizeof(descriptor_t), sizeof(descriptor_t));
 
-    os.free(size);
+    os.free(descriptor.size);
 }
 #endif
 
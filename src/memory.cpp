@@ -4,6 +4,9 @@
 
 namespace moducom { namespace dynamic {
 
+// out of line definition so that invalid_handle may be bound to references
+CONSTEXPR IMemory::handle_opaque_t IMemory::invalid_handle;
+
 Memory Memory::default_pool;
 
 Memory::handle_t Memory::allocate(size_t size)
@@ -0,0 +1,112 @@
+// Contention benchmark: lock-free ConcurrentLinkedListPool3 versus
+// LinkedListPool3 behind a mutex, at increasing thread counts
+//
+// usage: llpool-contention [iterations per thread]
+
+#include "exp/llpool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace moducom::mem::experimental;
+
+namespace {
+
+const size_t pool_size = 1024;
+// nodes each thread holds at once before giving them back
+const size_t batch = 8;
+
+// how we wrap pools today
+template <class T, size_t N>
+class MutexLinkedListPool3
+{
+    LinkedListPool3<T, N> pool;
+    std::mutex mutex;
+
+public:
+    typedef typename LinkedListPool3<T, N>::node_t node_t;
+
+    node_t* alloc()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+
+        return pool.alloc();
+    }
+
+    void free(node_t* node)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+
+        pool.free(node);
+    }
+};
+
+template <class TPool>
+void worker(TPool& pool, size_t iterations)
+{
+    typename TPool::node_t* nodes[batch];
+
+    for(size_t i = 0; i < iterations; i++)
+    {
+        for(size_t j = 0; j < batch; j++)
+        {
+            nodes[j] = pool.alloc();
+            nodes[j]->value = (int)j;
+        }
+
+        for(size_t j = 0; j < batch; j++)
+            pool.free(nodes[j]);
+    }
+}
+
+// @return nanoseconds per alloc/free pair
+template <class TPool>
+double run(TPool& pool, unsigned thread_count, size_t iterations)
+{
+    std::vector<std::thread> threads;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(unsigned t = 0; t < thread_count; t++)
+        threads.push_back(std::thread(worker<TPool>, std::ref(pool), iterations));
+
+    for(unsigned t = 0; t < thread_count; t++)
+        threads[t].join();
+
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+
+    return (double)elapsed.count() / (thread_count * iterations * batch);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULLPTR, 10) : 100000;
+    unsigned max_threads = std::thread::hardware_concurrency();
+
+    if(max_threads < 2) max_threads = 2;
+
+    printf("threads   mutex ns/op   lock-free ns/op\n");
+
+    for(unsigned thread_count = 1; thread_count <= max_threads; thread_count *= 2)
+    {
+        // fresh pools per round so neither benefits from a warm free list order
+        MutexLinkedListPool3<int, pool_size>* mutex_pool = new MutexLinkedListPool3<int, pool_size>;
+        ConcurrentLinkedListPool3<int, pool_size>* lockfree_pool = new ConcurrentLinkedListPool3<int, pool_size>;
+
+        double mutex_ns = run(*mutex_pool, thread_count, iterations);
+        double lockfree_ns = run(*lockfree_pool, thread_count, iterations);
+
+        printf("%7u   %11.1f   %15.1f\n", thread_count, mutex_ns, lockfree_ns);
+
+        delete mutex_pool;
+        delete lockfree_pool;
+    }
+
+    return 0;
+}
@@ -0,0 +1,597 @@
+// Allocator benchmark suite.  Replays the same deterministic allocation
+// traces against each allocator and reports, as JSON:
+//
+// - throughput of the whole trace, timed in one go
+// - per-operation latency percentiles, from a second separately timed pass
+// - fragmentation sampled over the course of the trace
+// - bookkeeping overhead per live allocation at peak
+//
+// usage: memlib-benchmarks [--ops N] [--seed N] [--filter substring] [--out file.json]
+
+#include "mc/memory_pool.h"
+#include "mc/memory-pool.h"
+#include "mc/objstack.h"
+#include "exp/llpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace moducom::dynamic;
+using namespace moducom::mem::experimental;
+
+namespace {
+
+// most live allocations any trace holds at once
+const size_t live_max = 48;
+// what fixed size traces ask for, and what fixed size pools hand out
+const size_t fixed_size = 32;
+// samples of fragmentation taken over a trace
+const size_t fragmentation_samples = 32;
+
+typedef uintptr_t token_t;
+
+struct Op
+{
+    bool allocate;
+    uint32_t slot;
+    uint32_t size;
+};
+
+struct Workload
+{
+    const char* name;
+    // true = every allocation is fixed_size bytes
+    bool fixed;
+    // true = frees always hit most recent allocation
+    bool lifo;
+    std::vector<Op> ops;
+};
+
+// xorshift, so traces are identical across platforms for a given seed
+struct Random
+{
+    uint32_t state;
+
+    Random(uint32_t seed) : state(seed ? seed : 1) {}
+
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    uint32_t range(uint32_t max) { return next() % max; }
+};
+
+// mostly small sizes with an occasional larger one, 16 - 256 bytes
+uint32_t mixed_size(Random& r)
+{
+    return r.range(4) == 0 ? 64 + r.range(193) : 16 + r.range(49);
+}
+
+// Allocations with random lifetimes.  Live count drifts between empty and live_max
+void generate_random_lifetime(Workload& w, size_t op_count, uint32_t seed)
+{
+    Random r(seed);
+    std::vector<uint32_t> live;
+    std::vector<uint32_t> free_slots;
+
+    for(uint32_t i = 0; i < live_max; i++) free_slots.push_back(live_max - 1 - i);
+
+    while(w.ops.size() < op_count)
+    {
+        bool allocate = live.empty() || (live.size() < live_max && r.range(2) == 0);
+        Op op;
+
+        op.allocate = allocate;
+
+        if(allocate)
+        {
+            op.slot = free_slots.back();
+            op.size = w.fixed ? fixed_size : mixed_size(r);
+            free_slots.pop_back();
+            live.push_back(op.slot);
+        }
+        else
+        {
+            uint32_t i = r.range(live.size());
+
+            op.slot = live[i];
+            op.size = 0;
+            live[i] = live.back();
+            live.pop_back();
+            free_slots.push_back(op.slot);
+        }
+
+        w.ops.push_back(op);
+    }
+}
+
+// Fill up to a random depth, then unwind it completely, repeatedly
+void generate_lifo(Workload& w, size_t op_count, uint32_t seed)
+{
+    Random r(seed);
+
+    while(w.ops.size() < op_count)
+    {
+        uint32_t depth = 1 + r.range(live_max);
+        Op op;
+
+        for(uint32_t i = 0; i < depth; i++)
+        {
+            op.allocate = true;
+            op.slot = i;
+            op.size = fixed_size;
+            w.ops.push_back(op);
+        }
+
+        for(uint32_t i = depth; i-- > 0;)
+        {
+            op.allocate = false;
+            op.slot = i;
+            op.size = 0;
+            w.ops.push_back(op);
+        }
+    }
+}
+
+// Queue-like: once live_max allocations are live, oldest is freed before each new one
+void generate_fifo(Workload& w, size_t op_count, uint32_t seed)
+{
+    Random r(seed);
+    uint32_t next_slot = 0;
+    Op op;
+
+    for(uint32_t i = 0; w.ops.size() < op_count; i++)
+    {
+        if(i >= live_max)
+        {
+            op.allocate = false;
+            op.slot = (i - live_max) % live_max;
+            op.size = 0;
+            w.ops.push_back(op);
+        }
+
+        op.allocate = true;
+        op.slot = next_slot;
+        op.size = w.fixed ? fixed_size : mixed_size(r);
+        w.ops.push_back(op);
+
+        next_slot = (next_slot + 1) % live_max;
+    }
+}
+
+std::vector<Workload> make_workloads(size_t op_count, uint32_t seed)
+{
+    std::vector<Workload> workloads(5);
+
+    workloads[0].name = "fixed";
+    workloads[0].fixed = true;
+    workloads[0].lifo = false;
+    generate_random_lifetime(workloads[0], op_count, seed);
+
+    // mixed sizes in FIFO order, random below being mixed sizes with random lifetimes
+    workloads[1].name = "mixed";
+    workloads[1].fixed = false;
+    workloads[1].lifo = false;
+    generate_fifo(workloads[1], op_count, seed);
+
+    workloads[2].name = "lifo";
+    workloads[2].fixed = true;
+    workloads[2].lifo = true;
+    generate_lifo(workloads[2], op_count, seed);
+
+    workloads[3].name = "fifo";
+    workloads[3].fixed = true;
+    workloads[3].lifo = false;
+    generate_fifo(workloads[3], op_count, seed);
+
+    workloads[4].name = "random";
+    workloads[4].fixed = false;
+    workloads[4].lifo = false;
+    generate_random_lifetime(workloads[4], op_count, seed);
+
+    return workloads;
+}
+
+
+// Each adapter exposes:
+//   name()                  label used in results
+//   fixed_only / lifo_only  which workloads it can run
+//   allocate(size, &token)  false on failure
+//   free(token, size)
+//   bytes_in_use()          bytes of backing store consumed, including bookkeeping
+//                           and rounding.  -1 when allocator can't say
+
+template <uint8_t page_count, IMemory::TierEnum tier>
+struct MemoryPoolAdapter
+{
+    // enough handle directory to track live_max allocations plus free runs
+    enum { page_size = 64, directory_pages = 4 };
+
+    MemoryPool<page_size, page_count> pool;
+
+    MemoryPoolAdapter() : pool(tier, directory_pages) {}
+
+    static const char* name() { return tier == IMemory::Indexed ? "MemoryPool/Indexed" : "MemoryPool/Indexed2"; }
+    static CONSTEXPR bool fixed_only = false;
+    static CONSTEXPR bool lifo_only = false;
+
+    bool allocate(size_t size, token_t* t)
+    {
+        IMemory::handle_opaque_t h = pool.allocate(size);
+
+        *t = h;
+
+        return h != IMemory::invalid_handle;
+    }
+
+    void free(token_t t, size_t) { pool.free(t); }
+
+    long bytes_in_use() const
+    {
+        return (long)((page_count - directory_pages) * page_size) - (long)pool.get_free();
+    }
+};
+
+struct DefaultPoolAdapter
+{
+    static const char* name() { return "Memory::default_pool"; }
+    static CONSTEXPR bool fixed_only = false;
+    static CONSTEXPR bool lifo_only = false;
+
+    bool allocate(size_t size, token_t* t)
+    {
+        *t = Memory::default_pool.allocate(size);
+
+        return *t != 0;
+    }
+
+    void free(token_t t, size_t) { Memory::default_pool.free(t); }
+
+    long bytes_in_use() const { return -1; }
+};
+
+struct Block
+{
+    uint8_t data[fixed_size];
+    bool active;
+
+    // PoolBase constructs allocated items in place
+    Block() : active(true) {}
+
+    bool is_active() const { return active; }
+    void allocate() { active = true; }
+    void free() { active = false; }
+    void initialize() { active = false; }
+};
+
+struct PoolBaseAdapter
+{
+    typedef PoolBase<Block, 256, ExplicitPoolItemTrait<Block> > pool_t;
+
+    pool_t pool;
+
+    static const char* name() { return "PoolBase"; }
+    static CONSTEXPR bool fixed_only = true;
+    static CONSTEXPR bool lifo_only = false;
+
+    // traces never hold more than live_max, so pool can't run dry
+    bool allocate(size_t, token_t* t)
+    {
+        *t = (token_t)&pool.allocate();
+
+        return true;
+    }
+
+    void free(token_t t, size_t) { pool.free((Block*)t); }
+
+    long bytes_in_use() const { return pool.count() * sizeof(Block); }
+};
+
+struct LinkedListPool2Adapter
+{
+    typedef LinkedListPool2<Block, 255> pool_t;
+
+    pool_t pool;
+
+    static const char* name() { return "LinkedListPool2"; }
+    static CONSTEXPR bool fixed_only = true;
+    static CONSTEXPR bool lifo_only = false;
+
+    bool allocate(size_t, token_t* t)
+    {
+        if(pool.is_full()) return false;
+
+        *t = pool.allocate(1);
+
+        return true;
+    }
+
+    void free(token_t t, size_t) { pool.deallocate(t, 1); }
+
+    long bytes_in_use() const { return (255 - pool.count_free()) * sizeof(Block); }
+};
+
+struct LinkedListPool3Adapter
+{
+    typedef LinkedListPool3<Block, 256> pool_t;
+
+    pool_t pool;
+
+    static const char* name() { return "LinkedListPool3"; }
+    static CONSTEXPR bool fixed_only = true;
+    static CONSTEXPR bool lifo_only = false;
+
+    // traces never hold more than live_max, so pool can't run dry
+    bool allocate(size_t, token_t* t)
+    {
+        *t = (token_t)pool.alloc();
+
+        return true;
+    }
+
+    void free(token_t t, size_t) { pool.free((pool_t::node_t*)t); }
+
+    long bytes_in_use() const { return (256 - pool.available()) * sizeof(pool_t::node_t); }
+};
+
+struct ObjStackAdapter
+{
+    uint8_t buffer[live_max * 512];
+    ObjStack stack;
+
+    ObjStackAdapter() : stack(moducom::pipeline::MemoryChunk(buffer, sizeof(buffer))) {}
+
+    static const char* name() { return "ObjStack"; }
+    static CONSTEXPR bool fixed_only = false;
+    static CONSTEXPR bool lifo_only = true;
+
+    bool allocate(size_t size, token_t* t)
+    {
+        if(stack.available() < size + sizeof(ObjStack::Descriptor)) return false;
+
+        *t = (token_t)stack.alloc(size);
+
+        return true;
+    }
+
+    void free(token_t t, size_t) { stack.free((void*)t); }
+
+    long bytes_in_use() const { return sizeof(buffer) - stack.available(); }
+};
+
+
+struct Result
+{
+    std::string name;
+    size_t ops;
+    size_t failures;
+    double total_ns;
+    std::vector<uint32_t> latencies;
+    // -1 entries mean allocator couldn't report
+    std::vector<double> fragmentation;
+    double overhead_per_allocation;
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Replays trace once.  When latencies is non null, each op is timed individually
+// and fragmentation is sampled along the way
+template <class TAdapter>
+size_t replay(TAdapter& a, const Workload& w, std::vector<uint32_t>* latencies, Result* r)
+{
+    token_t tokens[live_max];
+    uint32_t sizes[live_max];
+    bool valid[live_max];
+    size_t failures = 0;
+    size_t live_bytes = 0;
+    size_t live_count = 0;
+    const size_t sample_every = w.ops.size() / fragmentation_samples + 1;
+
+    memset(valid, 0, sizeof(valid));
+
+    for(size_t i = 0; i < w.ops.size(); i++)
+    {
+        const Op& op = w.ops[i];
+        bench_clock::time_point start;
+
+        if(latencies) start = bench_clock::now();
+
+        if(op.allocate)
+        {
+            valid[op.slot] = a.allocate(op.size, &tokens[op.slot]);
+            sizes[op.slot] = op.size;
+        }
+        else if(valid[op.slot])
+        {
+            a.free(tokens[op.slot], sizes[op.slot]);
+            valid[op.slot] = false;
+
+            if(latencies)
+            {
+                live_bytes -= sizes[op.slot];
+                live_count--;
+            }
+        }
+
+        if(!latencies) continue;
+
+        latencies->push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                bench_clock::now() - start).count());
+
+        if(op.allocate)
+        {
+            if(valid[op.slot])
+            {
+                live_bytes += op.size;
+                live_count++;
+            }
+            else
+                failures++;
+        }
+
+        long in_use = a.bytes_in_use();
+
+        // fraction of consumed backing store not holding user data
+        if(i % sample_every == 0)
+            r->fragmentation.push_back(in_use > 0 ? 1.0 - (double)live_bytes / in_use :
+                                       in_use == 0 ? 0 : -1);
+
+        if(in_use > 0 && live_count == live_max)
+        {
+            double overhead = (double)(in_use - live_bytes) / live_count;
+
+            if(overhead > r->overhead_per_allocation) r->overhead_per_allocation = overhead;
+        }
+    }
+
+    // leave nothing behind for allocators which outlive the run
+    for(size_t i = 0; i < live_max; i++)
+        if(valid[i]) a.free(tokens[i], sizes[i]);
+
+    return failures;
+}
+
+template <class TAdapter>
+void run(const Workload& w, const char* filter, std::vector<Result>& results)
+{
+    if(TAdapter::fixed_only && !w.fixed) return;
+    if(TAdapter::lifo_only && !w.lifo) return;
+
+    Result r;
+
+    r.name = std::string(w.name) + "/" + TAdapter::name();
+
+    if(filter && r.name.find(filter) == std::string::npos) return;
+
+    r.ops = w.ops.size();
+    r.overhead_per_allocation = -1;
+
+    // heap allocated as some adapters carry their whole pool inline
+    TAdapter* a = new TAdapter;
+
+    bench_clock::time_point start = bench_clock::now();
+    replay(*a, w, NULLPTR, &r);
+    r.total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count();
+
+    delete a;
+    a = new TAdapter;
+
+    r.latencies.reserve(w.ops.size());
+    r.failures = replay(*a, w, &r.latencies, &r);
+
+    delete a;
+
+    std::sort(r.latencies.begin(), r.latencies.end());
+
+    results.push_back(r);
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+{
+    if(sorted.empty()) return 0;
+
+    return sorted[(size_t)(p * (sorted.size() - 1))];
+}
+
+void write_json(FILE* out, const std::vector<Result>& results, size_t op_count, uint32_t seed)
+{
+    fprintf(out, "{\n  \"context\": {\n");
+    fprintf(out, "    \"ops_per_workload\": %lu,\n", (unsigned long)op_count);
+    fprintf(out, "    \"seed\": %lu,\n", (unsigned long)seed);
+    fprintf(out, "    \"live_max\": %lu\n", (unsigned long)live_max);
+    fprintf(out, "  },\n  \"benchmarks\": [\n");
+
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"name\": \"%s\",\n", r.name.c_str());
+        fprintf(out, "      \"ops\": %lu,\n", (unsigned long)r.ops);
+        fprintf(out, "      \"failures\": %lu,\n", (unsigned long)r.failures);
+        fprintf(out, "      \"ns_per_op\": %.2f,\n", r.total_ns / r.ops);
+        fprintf(out, "      \"ops_per_second\": %.0f,\n", r.ops * 1e9 / r.total_ns);
+        fprintf(out, "      \"latency_ns\": { \"p50\": %u, \"p90\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u },\n",
+                percentile(r.latencies, 0.5), percentile(r.latencies, 0.9),
+                percentile(r.latencies, 0.99), percentile(r.latencies, 0.999),
+                r.latencies.empty() ? 0 : r.latencies.back());
+
+        if(r.overhead_per_allocation < 0)
+            fprintf(out, "      \"overhead_bytes_per_allocation\": null,\n");
+        else
+            fprintf(out, "      \"overhead_bytes_per_allocation\": %.2f,\n", r.overhead_per_allocation);
+
+        fprintf(out, "      \"fragmentation\": [");
+
+        for(size_t j = 0; j < r.fragmentation.size(); j++)
+        {
+            if(j > 0) fprintf(out, ", ");
+
+            if(r.fragmentation[j] < 0)
+                fprintf(out, "null");
+            else
+                fprintf(out, "%.3f", r.fragmentation[j]);
+        }
+
+        fprintf(out, "]\n    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    size_t op_count = 200000;
+    uint32_t seed = 1;
+    const char* filter = NULLPTR;
+    const char* out_name = NULLPTR;
+
+    for(int i = 1; i + 1 < argc; i += 2)
+    {
+        if(strcmp(argv[i], "--ops") == 0) op_count = strtoul(argv[i + 1], NULLPTR, 10);
+        else if(strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], NULLPTR, 10);
+        else if(strcmp(argv[i], "--filter") == 0) filter = argv[i + 1];
+        else if(strcmp(argv[i], "--out") == 0) out_name = argv[i + 1];
+    }
+
+    std::vector<Workload> workloads = make_workloads(op_count, seed);
+    std::vector<Result> results;
+
+    for(size_t i = 0; i < workloads.size(); i++)
+    {
+        const Workload& w = workloads[i];
+
+        run<MemoryPoolAdapter<255, IMemory::Indexed> >(w, filter, results);
+        run<MemoryPoolAdapter<255, IMemory::Indexed2> >(w, filter, results);
+        run<DefaultPoolAdapter>(w, filter, results);
+        run<PoolBaseAdapter>(w, filter, results);
+        run<LinkedListPool2Adapter>(w, filter, results);
+        run<LinkedListPool3Adapter>(w, filter, results);
+        run<ObjStackAdapter>(w, filter, results);
+    }
+
+    FILE* out = out_name ? fopen(out_name, "w") : stdout;
+
+    if(out == NULLPTR)
+    {
+        fprintf(stderr, "unable to open %s\n", out_name);
+        return 1;
+    }
+
+    write_json(out, results, op_count, seed);
+
+    if(out != stdout) fclose(out);
+
+    return 0;
+}
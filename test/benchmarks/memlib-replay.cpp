@@ -0,0 +1,320 @@
+// Replays a MemoryTrace, as recorded by TracingMemory, against an IMemory
+// and reports throughput, peak footprint and failures as JSON
+//
+// usage: memlib-replay trace.bin [target]
+//
+// target is one of:
+//   malloc                                 Memory::default_pool (default)
+//   indexed/<page_size>/<page_count>       MemoryPool, Indexed tier
+//   indexed2/<page_size>/<page_count>      MemoryPool, Indexed2 tier
+// optionally followed by /<directory_pages>
+//
+// page_size may be 16, 32, 64, 128 or 256, page_count 64, 128 or 255
+
+#include "mc/memory_pool.h"
+#include "mc/memory-trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace moducom::dynamic;
+
+namespace {
+
+struct ReplayTarget
+{
+    virtual ~ReplayTarget() {}
+
+    virtual IMemory& memory() = 0;
+
+    // bytes of backing store currently consumed, or -1 if unknown
+    virtual long footprint() const { return -1; }
+};
+
+struct MallocTarget : ReplayTarget
+{
+    virtual IMemory& memory() OVERRIDE { return Memory::default_pool; }
+};
+
+template <size_t page_size, uint8_t page_count>
+struct PoolTarget : ReplayTarget
+{
+    MemoryPool<page_size, page_count> pool;
+    uint8_t directory_pages;
+
+    PoolTarget(IMemory::TierEnum tier, uint8_t directory_pages) :
+        pool(tier, directory_pages),
+        directory_pages(directory_pages) {}
+
+    virtual IMemory& memory() OVERRIDE { return pool; }
+
+    // whole directory counts, since that's what was set aside
+    virtual long footprint() const OVERRIDE
+    {
+        return (long)(page_count * page_size) - (long)pool.get_free();
+    }
+};
+
+template <size_t page_size>
+ReplayTarget* create_pool(IMemory::TierEnum tier, unsigned page_count, uint8_t directory_pages)
+{
+    switch(page_count)
+    {
+        case 64: return new PoolTarget<page_size, 64>(tier, directory_pages);
+        case 128: return new PoolTarget<page_size, 128>(tier, directory_pages);
+        case 255: return new PoolTarget<page_size, 255>(tier, directory_pages);
+        default: return NULLPTR;
+    }
+}
+
+ReplayTarget* create_target(const char* spec)
+{
+    if(strcmp(spec, "malloc") == 0) return new MallocTarget;
+
+    char tier_name[16];
+    unsigned page_size, page_count, directory_pages = 1;
+
+    if(sscanf(spec, "%15[a-z0-9]/%u/%u/%u", tier_name, &page_size, &page_count, &directory_pages) < 3)
+        return NULLPTR;
+
+    IMemory::TierEnum tier;
+
+    if(strcmp(tier_name, "indexed") == 0) tier = IMemory::Indexed;
+    else if(strcmp(tier_name, "indexed2") == 0) tier = IMemory::Indexed2;
+    else return NULLPTR;
+
+    if(directory_pages == 0 || directory_pages >= page_count) return NULLPTR;
+
+    switch(page_size)
+    {
+        case 16: return create_pool<16>(tier, page_count, directory_pages);
+        case 32: return create_pool<32>(tier, page_count, directory_pages);
+        case 64: return create_pool<64>(tier, page_count, directory_pages);
+        case 128: return create_pool<128>(tier, page_count, directory_pages);
+        case 256: return create_pool<256>(tier, page_count, directory_pages);
+        default: return NULLPTR;
+    }
+}
+
+bool read_file(const char* name, std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(name, "rb");
+
+    if(f == NULLPTR) return false;
+
+    uint8_t buffer[4096];
+    size_t n;
+
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+
+    fclose(f);
+
+    return true;
+}
+
+struct Stats
+{
+    size_t ops;
+    size_t failed_allocations;
+    size_t failed_expands;
+    size_t failed_frees;
+    // records referring to a handle replay never saw allocated
+    size_t skipped;
+    uint64_t recorded_us;
+    uint64_t replay_ns;
+    long peak_footprint;
+    uint64_t peak_live_bytes;
+};
+
+struct Live
+{
+    IMemory::handle_opaque_t handle;
+    uint64_t size;
+};
+
+typedef std::unordered_map<IMemory::handle_opaque_t, Live> handle_map_t;
+
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s trace.bin [malloc | indexed/PS/PC[/DP] | indexed2/PS/PC[/DP]]\n", argv[0]);
+        return 1;
+    }
+
+    const char* spec = argc > 2 ? argv[2] : "malloc";
+    std::vector<uint8_t> trace;
+
+    if(!read_file(argv[1], trace))
+    {
+        fprintf(stderr, "unable to read %s\n", argv[1]);
+        return 1;
+    }
+
+    if(trace.size() < 5 || memcmp(&trace[0], MemoryTrace::magic(), 4) != 0 ||
+       trace[4] != MemoryTrace::version)
+    {
+        fprintf(stderr, "%s is not a version %d memory trace\n", argv[1], MemoryTrace::version);
+        return 1;
+    }
+
+    ReplayTarget* target = create_target(spec);
+
+    if(target == NULLPTR)
+    {
+        fprintf(stderr, "unsupported target %s\n", spec);
+        return 1;
+    }
+
+    IMemory& memory = target->memory();
+    handle_map_t live;
+    Stats stats;
+    uint64_t live_bytes = 0;
+    size_t pos = 5;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.peak_footprint = target->footprint();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    while(pos < trace.size())
+    {
+        MemoryTrace::Record r;
+        size_t consumed = MemoryTrace::decode(&trace[pos], trace.size() - pos, &r);
+
+        if(consumed == 0)
+        {
+            fprintf(stderr, "malformed record at offset %lu\n", (unsigned long)pos);
+            break;
+        }
+
+        pos += consumed;
+        stats.ops++;
+        stats.recorded_us += r.delta_us;
+
+        if(r.op == MemoryTrace::Allocate)
+        {
+            // allocation also failed when recorded, nothing to replay
+            if(r.handle == IMemory::invalid_handle) continue;
+
+            Live l;
+
+            l.handle = memory.allocate(r.size);
+            l.size = r.size;
+
+            if(l.handle == IMemory::invalid_handle)
+            {
+                stats.failed_allocations++;
+                continue;
+            }
+
+            live[r.handle] = l;
+            live_bytes += l.size;
+        }
+        // recorded call changed nothing, so neither should replay
+        else if(r.failed) continue;
+        else
+        {
+            handle_map_t::iterator i = live.find(r.handle);
+
+            if(i == live.end())
+            {
+                stats.skipped++;
+                continue;
+            }
+
+            Live& l = i->second;
+
+            switch(r.op)
+            {
+                case MemoryTrace::Free:
+                    if(!memory.free(l.handle))
+                    {
+                        stats.failed_frees++;
+                        break;
+                    }
+
+                    live_bytes -= l.size;
+                    live.erase(i);
+                    break;
+
+                case MemoryTrace::Expand:
+                    if(!memory.expand(l.handle, r.size))
+                        stats.failed_expands++;
+                    else if(r.size > l.size)
+                    {
+                        live_bytes += r.size - l.size;
+                        l.size = r.size;
+                    }
+                    break;
+
+                case MemoryTrace::Shrink:
+                    memory.shrink(l.handle, r.size);
+
+                    if(r.size < l.size)
+                    {
+                        live_bytes -= l.size - r.size;
+                        l.size = r.size;
+                    }
+                    break;
+
+                case MemoryTrace::Lock:
+                    memory.lock(l.handle);
+                    break;
+
+                case MemoryTrace::Unlock:
+                    memory.unlock(l.handle);
+                    break;
+
+                default: break;
+            }
+        }
+
+        if(live_bytes > stats.peak_live_bytes) stats.peak_live_bytes = live_bytes;
+
+        // only footprint growing ops can set a new peak
+        if(r.op == MemoryTrace::Allocate || r.op == MemoryTrace::Expand)
+        {
+            long footprint = target->footprint();
+
+            if(footprint > stats.peak_footprint) stats.peak_footprint = footprint;
+        }
+    }
+
+    // NOTE: includes footprint probing, which for MemoryPool is a walk of its free runs
+    stats.replay_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    for(handle_map_t::iterator i = live.begin(); i != live.end(); ++i)
+        memory.free(i->second.handle);
+
+    printf("{\n");
+    printf("  \"target\": \"%s\",\n", spec);
+    printf("  \"ops\": %lu,\n", (unsigned long)stats.ops);
+    printf("  \"recorded_seconds\": %.6f,\n", stats.recorded_us / 1e6);
+    printf("  \"replay_seconds\": %.6f,\n", stats.replay_ns / 1e9);
+    printf("  \"ops_per_second\": %.0f,\n", stats.replay_ns ? stats.ops * 1e9 / stats.replay_ns : 0);
+    printf("  \"failed_allocations\": %lu,\n", (unsigned long)stats.failed_allocations);
+    printf("  \"failed_expands\": %lu,\n", (unsigned long)stats.failed_expands);
+    printf("  \"failed_frees\": %lu,\n", (unsigned long)stats.failed_frees);
+    printf("  \"skipped\": %lu,\n", (unsigned long)stats.skipped);
+    printf("  \"peak_live_bytes\": %lu,\n", (unsigned long)stats.peak_live_bytes);
+
+    if(stats.peak_footprint < 0)
+        printf("  \"peak_footprint_bytes\": null\n");
+    else
+        printf("  \"peak_footprint_bytes\": %ld\n", stats.peak_footprint);
+
+    printf("}\n");
+
+    delete target;
+
+    return 0;
+}
@@ -94,4 +94,23 @@ TEST_CASE("Experimental tests", "[experimental]")
 
         pool.deallocate(h, 1);
     }
+    SECTION("Latest memory pool incarnation batch")
+    {
+        typedef moducom::mem::experimental::LinkedListPool2<int, 10> pool_t;
+        pool_t pool;
+        pool_t::handle_type handles[11];
+
+        REQUIRE(pool.allocate_n(handles, 4) == 4);
+        REQUIRE(handles[3] == 3);
+        REQUIRE(pool.count_free() == 6);
+
+        pool.deallocate_n(handles, 4);
+        REQUIRE(pool.count_free() == 10);
+
+        REQUIRE(pool.allocate_n(handles, 11) == 10);
+        REQUIRE(pool.is_full());
+
+        pool.deallocate_n(handles, 10);
+        REQUIRE(pool.count_free() == 10);
+    }
 }
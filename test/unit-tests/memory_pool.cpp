@@ -7,7 +7,15 @@
 #include "../coap-token.h"
 #endif
 #include "mc/objstack.h"
+#include "mc/objstack-arena.h"
 #include "exp/llpool.h"
+#include "mc/memory-mapped.h"
+#include "mc/memory-pages.h"
+#include "mc/memory-resource.h"
+
+#include <thread>
+#include <map>
+#include <vector>
 
 using namespace moducom::dynamic;
 
@@ -165,6 +173,34 @@ public:
 };
 #endif
 
+// minimal pool item which knows its own allocation state, for use with
+// DefaultPoolItemTrait
+struct TestPoolItem
+{
+    int value;
+    bool active;
+
+    TestPoolItem() : value(0), active(false) {}
+
+    TestPoolItem(int value) : value(value), active(true) {}
+
+    ~TestPoolItem() { active = false; }
+
+    bool is_active() const { return active; }
+};
+
+// pool item which is told of its allocation state, for use with
+// ExplicitPoolItemTrait
+struct TestExplicitPoolItem
+{
+    bool active;
+
+    bool is_active() const { return active; }
+    void allocate() { active = true; }
+    void free() { active = false; }
+    void initialize() { active = false; }
+};
+
 TEST_CASE("Low-level memory pool tests", "[mempool-low]")
 {
     SECTION("Index1 memory pool")
@@ -174,6 +210,124 @@ TEST_CASE("Low-level memory pool tests", "[mempool-low]")
         int handle = pool.allocate(100);
 
         REQUIRE(pool.get_free() == (32 * (128 - 1) - 128));
+
+        SECTION("Coalescing")
+        {
+            IMemory::handle_opaque_t h2 = pool.allocate(100);
+            IMemory::handle_opaque_t h3 = pool.allocate(100);
+
+            pool.free(h2);
+            pool.free(handle);
+            pool.free(h3);
+
+            // everything merged back into one free run, nothing left for compaction
+            REQUIRE(pool.compact(1) == 0);
+            REQUIRE(pool.get_free() == 32 * (128 - 1));
+            REQUIRE(pool.allocate(32 * (128 - 1)) != IMemory::invalid_handle);
+        }
+        SECTION("Expand and shrink")
+        {
+            IMemory::handle_opaque_t h2 = pool.allocate(100);
+
+            strcpy((char*)pool.lock(handle), "handle");
+            pool.unlock(handle);
+
+            // h2 sits right after handle, so this must relocate
+            REQUIRE(pool.expand(handle, 200));
+            REQUIRE(strcmp((char*)pool.lock(handle), "handle") == 0);
+            pool.unlock(handle);
+            REQUIRE(pool.get_free() == 32 * (128 - 1) - 128 - 224);
+
+            pool.shrink(handle, 64);
+
+            REQUIRE(pool.get_free() == 32 * (128 - 1) - 128 - 64);
+
+            // tail pages just released are absorbed back in place
+            void* p = pool.lock(handle);
+            pool.unlock(handle);
+
+            REQUIRE(pool.expand(handle, 150));
+            REQUIRE(pool.lock(handle) == p);
+            pool.unlock(handle);
+
+            // locked allocations can only grow in place
+            pool.lock(h2);
+            REQUIRE(!pool.expand(h2, 200));
+            pool.unlock(h2);
+        }
+        SECTION("Compaction")
+        {
+            // 4 pages already allocated above, carve up much of the remainder
+            IMemory::handle_opaque_t h1 = pool.allocate(30 * 32);
+            IMemory::handle_opaque_t h2 = pool.allocate(30 * 32);
+            IMemory::handle_opaque_t h3 = pool.allocate(30 * 32);
+            IMemory::handle_opaque_t h4 = pool.allocate(30 * 32);
+
+            strcpy((char*)pool.lock(h4), "h4");
+            pool.unlock(h4);
+
+            pool.free(h1);
+            pool.free(h3);
+
+            // 63 pages free, but largest run is only 30
+            REQUIRE(pool.get_free() == 63 * 32);
+
+            SECTION("full")
+            {
+                IMemory::handle_opaque_t h5 = pool.allocate(50 * 32);
+
+                REQUIRE(h5 != IMemory::invalid_handle);
+                REQUIRE(strcmp((char*)pool.lock(h4), "h4") == 0);
+                pool.unlock(h4);
+                REQUIRE(pool.get_free() == 13 * 32);
+            }
+            SECTION("incremental")
+            {
+                // slide h2 down
+                REQUIRE(pool.compact(1) == 1);
+                // merge freed h1 and h3 remnants, slide h4 down, merge trailing free run
+                REQUIRE(pool.compact(10) == 3);
+                REQUIRE(pool.compact(1) == 0);
+                REQUIRE(strcmp((char*)pool.lock(h4), "h4") == 0);
+                pool.unlock(h4);
+            }
+            SECTION("locked allocations stay put")
+            {
+                void* h2_locked = pool.lock(h2);
+
+                pool.compact();
+
+                REQUIRE(pool.allocate(50 * 32) == IMemory::invalid_handle);
+
+                pool.unlock(h2);
+
+                REQUIRE(pool.lock(h2) == h2_locked);
+                pool.unlock(h2);
+            }
+        }
+    }
+    SECTION("Index1 runs past 127 pages")
+    {
+        MemoryPool<16, 255> pool;
+
+        // initial free run is 254 pages, which once didn't fit handle's size field
+        REQUIRE(pool.get_free() == 16 * 254);
+
+        IMemory::handle_opaque_t big = pool.allocate(200 * 16);
+        IMemory::handle_opaque_t small = pool.allocate(16);
+
+        REQUIRE(big != IMemory::invalid_handle);
+        REQUIRE(small != IMemory::invalid_handle);
+
+        strcpy((char*)pool.lock(small), "small");
+        pool.unlock(small);
+
+        pool.free(big);
+        pool.compact();
+
+        REQUIRE(strcmp((char*)pool.lock(small), "small") == 0);
+        pool.unlock(small);
+        REQUIRE(pool.allocate(253 * 16) != IMemory::invalid_handle);
     }
     SECTION("Index2 memory pool")
     {
@@ -203,6 +357,173 @@ TEST_CASE("Low-level memory pool tests", "[mempool-low]")
                                        unallocated_count * sizeof(handle_t::PageData)
             );
         }
+        SECTION("Expand and shrink")
+        {
+            IMemory::handle_opaque_t h1 = pool.allocate(100);
+            IMemory::handle_opaque_t h2 = pool.allocate(100);
+
+            strcpy((char*)pool.lock(h1), "h1");
+            pool.unlock(h1);
+
+            // h2 sits right after h1, so this must relocate
+            REQUIRE(pool.expand(h1, 200));
+            REQUIRE(strcmp((char*)pool.lock(h1), "h1") == 0);
+            pool.unlock(h1);
+            REQUIRE(pool.get_allocated_handle_count() == 2);
+
+            size_t free_before = pool.get_free();
+
+            pool.shrink(h1, 32 - sizeof(handle_t::PageData));
+
+            REQUIRE(pool.get_free() > free_before);
+
+            void* p = pool.lock(h1);
+            pool.unlock(h1);
+
+            // tail pages just released are absorbed back in place
+            REQUIRE(pool.expand(h1, 150));
+            REQUIRE(pool.lock(h1) == p);
+            pool.unlock(h1);
+
+            pool.lock(h2);
+            REQUIRE(!pool.expand(h2, 200));
+            pool.unlock(h2);
+        }
+        SECTION("Compaction")
+        {
+            // sizes include PageData header, so each allocation is exactly 30 pages
+            const size_t size = 30 * 32 - sizeof(handle_t::PageData);
+
+            IMemory::handle_opaque_t h1 = pool.allocate(size);
+            IMemory::handle_opaque_t h2 = pool.allocate(size);
+            IMemory::handle_opaque_t h3 = pool.allocate(size);
+            IMemory::handle_opaque_t h4 = pool.allocate(size);
+
+            strcpy((char*)pool.lock(h2), "h2");
+            pool.unlock(h2);
+            strcpy((char*)pool.lock(h4), "h4");
+            pool.unlock(h4);
+
+            pool.free(h1);
+            pool.free(h3);
+
+            // free space is split into two 30 page runs and a 7 page run, so this only
+            // succeeds by way of compaction
+            IMemory::handle_opaque_t h5 = pool.allocate(50 * 32);
+
+            REQUIRE(h5 != IMemory::invalid_handle);
+
+            REQUIRE(strcmp((char*)pool.lock(h2), "h2") == 0);
+            pool.unlock(h2);
+            REQUIRE(strcmp((char*)pool.lock(h4), "h4") == 0);
+            pool.unlock(h4);
+
+            // after compaction, only one free run remains
+            REQUIRE(pool.get_allocated_handle_count(false) == 1);
+            REQUIRE(pool.compact(1) == 0);
+        }
+        SECTION("Coalescing")
+        {
+            IMemory::handle_opaque_t h1 = pool.allocate(100);
+            IMemory::handle_opaque_t h2 = pool.allocate(100);
+            IMemory::handle_opaque_t h3 = pool.allocate(100);
+
+            pool.free(h2);
+
+            REQUIRE(pool.get_allocated_handle_count(false) == 2);
+
+            // merges with h2's run on one side
+            pool.free(h1);
+
+            REQUIRE(pool.get_allocated_handle_count(false) == 2);
+
+            // merges with both sides
+            pool.free(h3);
+
+            REQUIRE(pool.get_allocated_handle_count(false) == 1);
+            REQUIRE(pool.get_allocated_handle_count() == 0);
+            REQUIRE(pool.get_free() == 32 * (128 - 1) - sizeof(handle_t::PageData));
+            REQUIRE(pool.compact(1) == 0);
+        }
+        SECTION("Free run index")
+        {
+            typedef MemoryPoolIndexed2HandlePage::FreeRunIndex index_t;
+            // exactly 2 pages each
+            const size_t size = 64 - sizeof(handle_t::PageData);
+            IMemory::handle_opaque_t h[8];
+
+            for(int i = 0; i < 8; i++) h[i] = pool.allocate(size);
+
+            // more free runs than index holds
+            for(int i = 0; i < 8; i += 2) pool.free(h[i]);
+
+            REQUIRE(pool.get_allocated_handle_count(false) == 5);
+
+            // each freed run is an exact fit, so is preferred over large trailing run
+            for(int i = 0; i < 8; i += 2)
+            {
+                IMemory::handle_opaque_t reused = pool.allocate(size);
+                bool was_freed = false;
+
+                for(int j = 0; j < 8; j += 2) was_freed |= reused == h[j];
+
+                REQUIRE(was_freed);
+                REQUIRE(pool.get_allocated_handle_count(false) == (size_t)(4 - i / 2));
+            }
+
+            REQUIRE(pool.get_free() == (127 - 16) * 32 - sizeof(handle_t::PageData));
+            REQUIRE(index_t::size_class(1) == 0);
+            REQUIRE(index_t::size_class(111) == 6);
+        }
+        SECTION("Partial free run index refills lazily")
+        {
+            // extra directory pages for handles to spare
+            MemoryPool<> many(IMemory::Indexed2, 4);
+            const size_t one_page = 32 - sizeof(handle_t::PageData);
+            IMemory::handle_opaque_t h[40];
+
+            for(int i = 0; i < 40; i++) h[i] = many.allocate(one_page);
+
+            // 20 single page runs plus trailing run, against an index holding 3
+            for(int i = 0; i < 40; i += 2) many.free(h[i]);
+
+            const size_t largest = many.stats().largest_free_run;
+            const uint32_t walks = many.stats().free_run_walks;
+
+            for(int i = 0; i < 20; i++) REQUIRE(many.allocate(one_page) != IMemory::invalid_handle);
+
+            // data pages walked once per two allocations, rather than on every one
+            REQUIRE(many.stats().free_run_walks - walks <= 10);
+            // unindexed single page runs still filled ahead of carving up trailing run
+            REQUIRE(many.stats().largest_free_run == largest);
+        }
+        SECTION("Shrinking indexed free runs")
+        {
+            const size_t one_page = 32 - sizeof(handle_t::PageData);
+            IMemory::handle_opaque_t a[4], f[4];
+
+            for(int i = 0; i < 4; i++)
+            {
+                a[i] = pool.allocate(one_page);
+                f[i] = pool.allocate(one_page + 9 * 32);
+            }
+
+            IMemory::handle_opaque_t rest = pool.allocate(pool.get_free());
+
+            // four 10 page runs, more than index holds
+            for(int i = 0; i < 4; i++) pool.free(f[i]);
+
+            // indexed runs shrink down to 1 page, leaving an unindexed 10 page run
+            for(int i = 0; i < 3; i++) REQUIRE(pool.expand(a[i], one_page + 9 * 32));
+
+            REQUIRE(pool.stats().largest_free_run == 10 * 32 - sizeof(handle_t::PageData));
+
+            // with everything locked, compaction can't be what finds room
+            for(int i = 0; i < 4; i++) pool.lock(a[i]);
+            pool.lock(rest);
+
+            REQUIRE(pool.allocate(one_page + 4 * 32) != IMemory::invalid_handle);
+        }
         SECTION("Locking")
         {
             REQUIRE(pool.get_allocated_handle_count() == 0);
@@ -220,170 +541,1320 @@ TEST_CASE("Low-level memory pool tests", "[mempool-low]")
 
             REQUIRE(pool.get_allocated_handle_count() == 0);
         }
-    }
-#ifdef ENABLE_COAP
-    SECTION("Traditional memory pool")
-    {
-        PoolBase<TestToken, 8> pool;
-        TestToken hardcoded;
+        SECTION("Nested locking")
+        {
+            IMemory::handle_opaque_t h1 = pool.allocate(100);
+            IMemory::handle_opaque_t h2 = pool.allocate(100);
 
-        hardcoded.set("1234", 4);
+            // two independent users lock h2
+            char* p = (char*)pool.lock(h2);
+            strcpy(p, "h2");
+            REQUIRE(pool.lock(h2) == p);
 
-        REQUIRE(pool.count() == 0);
+            pool.free(h1);
+            pool.unlock(h2);
 
-        TestToken* allocated = pool.allocate(hardcoded);
+            // still held once, so compaction must leave it be
+            REQUIRE(pool.compact(8) == 0);
+            REQUIRE(pool.get_data(h2) == (uint8_t*)p);
 
-        REQUIRE(pool.count() == 1);
+            pool.unlock(h2);
 
-        pool.free(allocated);
+            // fully released, now it may move.  Handle stays valid
+            REQUIRE(pool.compact(8) > 0);
+            REQUIRE(pool.get_data(h2) != (uint8_t*)p);
+            REQUIRE(strcmp((char*)pool.lock(h2), "h2") == 0);
+            pool.unlock(h2);
 
-        REQUIRE(pool.count() == 0);
+            // lock count saturates rather than wrapping around
+            for(int i = 0; i < handle_t::PageData::max_lock_count(); i++)
+                REQUIRE(pool.lock(h2) != NULLPTR);
+
+            REQUIRE(pool.lock(h2) == NULLPTR);
+
+            pool.unlock(h2);
+            REQUIRE(pool.compact(8) == 0);
+        }
     }
-#endif
-    SECTION("Object Stack")
+    SECTION("Multi-page handle directory")
     {
-        moducom::pipeline::layer2::MemoryChunk<512> chunk;
-        ObjStack os(chunk);
+        SECTION("Index1")
+        {
+            MemoryPool<> small_pool;
+            MemoryPool<> pool(IMemory::Indexed, 2);
+            int small_count = 0;
 
-        int* val = new (os) int;
+            while(small_pool.allocate(32) != IMemory::invalid_handle) small_count++;
 
-        void* buffer = os.alloc(10);
+            REQUIRE(pool.get_free() == 32 * (128 - 2));
 
-        REQUIRE(os.length() == 512 - sizeof(int) - 10
-#ifdef FEATURE_MC_MEM_OBJSTACK_CHECK
-                               - sizeof(ObjStack::Descriptor) * 2
-#endif
-                                );
+            for(int i = 0; i < small_count * 2; i++)
+            {
+                IMemory::handle_opaque_t h = pool.allocate(32);
 
-#ifdef FEATURE_MC_MEM_OBJSTACK_GNUSTYLE
-        os.free(buffer);
-#else
-        os.free(10);
-#endif
-        os.del(val);
+                REQUIRE(h != IMemory::invalid_handle);
 
-        REQUIRE(os.length() == 512);
-    }
-    SECTION("LinkedListPool")
-    {
-        typedef moducom::mem::LinkedListPool<int, 4> llpool_t;
-        typedef llpool_t::item_t item_t;
-        llpool_t pool;
+                *(int*)pool.lock(h) = i;
+                pool.unlock(h);
+            }
 
-        int* item = pool.allocate();
+            REQUIRE(*(int*)pool.lock(small_count) == small_count);
+            pool.unlock(small_count);
+        }
+        SECTION("Index2")
+        {
+            typedef MemoryPoolIndexed2HandlePage::handle_t handle_t;
+            // exactly 1 page each
+            const size_t size = 32 - sizeof(handle_t::PageData);
 
-        *item = 5;
+            MemoryPool<> pool(IMemory::Indexed2, 2);
+            IMemory::handle_opaque_t h[40];
 
-        const auto& allocated = pool.allocated();
-        auto iterator = allocated.begin();
+            for(int i = 0; i < 40; i++)
+            {
+                h[i] = pool.allocate(size);
 
-        REQUIRE(iterator.lock().value() == 5);
-        iterator++;
-        REQUIRE(iterator == allocated.end());
-        REQUIRE(!allocated.empty());
+                REQUIRE(h[i] != IMemory::invalid_handle);
+            }
 
-        pool.deallocate(item);
+            REQUIRE(pool.get_allocated_handle_count() == 40);
+            REQUIRE(pool.get_free() == (128 - 2 - 40) * 32 - sizeof(handle_t::PageData));
 
-        REQUIRE(allocated.empty());
+            for(int i = 0; i < 40; i++) pool.free(h[i]);
+
+            REQUIRE(pool.get_allocated_handle_count() == 0);
+            REQUIRE(pool.get_allocated_handle_count(false) == 1);
+        }
     }
-    SECTION("Experimental pool slot management")
+    SECTION("Allocate with data and copy")
     {
-        typedef int value_type;
-        typedef moducom::mem::experimental::intrusive_node_pool_traits node_traits_t;
-        typedef typename node_traits_t::node_allocator_t<value_type> node_allocator_t;
-        typedef typename node_allocator_t::node_type node_type;
-        // FIX: node_traits behavior in flux, especially allocator.  Disable
-        // this test for now
-#ifdef UNUSED
-        typedef estd::forward_list<value_type, node_traits_t> list2_t;
+        MemoryPool<> pool(IMemory::Indexed2);
+        MemoryPool<64, 32> other;
 
-        list2_t list;
-        node_type value;
+        const MemorySpan spans[] =
+        {
+            { "header:", 7 },
+            { "payload", 8 }
+        };
 
-        value.value() = 5;
+        IMemory::handle_opaque_t h = pool.allocate(spans, 2);
 
-        list.push_front(value);
+        REQUIRE(h != IMemory::invalid_handle);
+        REQUIRE(strcmp((char*)pool.lock(h), "header:payload") == 0);
+        pool.unlock(h);
 
-        // following doesn't quite work yet, compiler tells me I'm
-        // trying to convert int& to intrusive_node_pool_node_type<int>,
-        // but nearly as I can tell we should in fact be starting with intrusive_node_pool_node_type<int>*
-        //REQUIRE(list.front() == 5);
-#endif
-    }
-    SECTION("LinkedListPool as allocator for other linked list")
-    {
-        typedef moducom::mem::LinkedListPool<int, 10> llpool_t;
-        typedef AllocatorRefHelper<llpool_t::item_t> allocator_t;
-#ifdef UNUSED
-        typedef estd::inlinevalue_node_traits<
-                estd::experimental::forward_node_base,
-                AllocatorRefHelper> node_traits_t;
+        // spans larger than requested size
+        REQUIRE(pool.allocate(spans, 2, 10) == IMemory::invalid_handle);
 
-        llpool_t pool;
-        allocator_t allocator();
+        IMemory::handle_opaque_t h2 = pool.allocate("Hi", 10, 3);
 
-        // FIX: node_traits behavior in flux, especially allocator.  Disable
-        // this test for now
-        // FIX: allocator_t initialization still clumsy, because we like
-        // having 'empty' allocators we can pass around.  We are
-        // interrupting purely inline value allocators from comfortably
-        // existing
-        estd::forward_list<int, node_traits_t> list(&allocator);
+        REQUIRE(strcmp((char*)pool.lock(h2), "Hi") == 0);
+        pool.unlock(h2);
 
-        REQUIRE(list.empty());
+        // through IMemory, within same pool
+        IMemory& memory = pool;
+        IMemory::handle_opaque_t h3 = memory.copy(h, 100, 15);
 
-        list.push_front(5);
+        REQUIRE(strcmp((char*)pool.lock(h3), "header:payload") == 0);
+        pool.unlock(h3);
 
-        REQUIRE(!list.empty());
+        // pool to pool, across tiers and page sizes
+        IMemory::handle_opaque_t h4 = other.copy(pool, h, 15);
 
-        auto i = list.begin();
+        REQUIRE(h4 != IMemory::invalid_handle);
+        REQUIRE(strcmp((char*)other.lock(h4), "header:payload") == 0);
+        other.unlock(h4);
 
-        REQUIRE(*i == 5);
+        REQUIRE(other.copy(pool, IMemory::invalid_handle, 15) == IMemory::invalid_handle);
 
-        // nearly there, this has a const qualifier drop somewhere
-        //REQUIRE(list.front() == 5);
-#endif
+        SECTION("into larger allocation")
+        {
+            typedef ExternalMemoryPool<MemoryPoolIndexed2Tier, 32, 8> small_pool_t;
+
+            // exactly sized, so reading past source's run reads past span
+            std::vector<uint8_t> span(small_pool_t::span_size());
+            small_pool_t source(span.data());
+
+            source.initialize();
+
+            IMemory::handle_opaque_t filler = source.allocate(5 * 32);
+            IMemory::handle_opaque_t last = source.allocate("last", 5);
+
+            REQUIRE(filler != IMemory::invalid_handle);
+            REQUIRE(source.get_data(last) + source.get_size(last) == span.data() + span.size());
+
+            // realloc style, size_copy left to default
+            IMemory::handle_opaque_t grown = pool.copy(source, last, 500);
+
+            REQUIRE(grown != IMemory::invalid_handle);
+            REQUIRE(strcmp((char*)pool.get_data(grown), "last") == 0);
+
+            // size_copy past size is held to size
+            IMemory::handle_opaque_t shrunk = pool.copy(source, last, 3, 100);
+
+            REQUIRE(shrunk != IMemory::invalid_handle);
+            REQUIRE(memcmp(pool.get_data(shrunk), "las", 3) == 0);
+        }
     }
-    SECTION("Using LinkedListPoolNodeTraits")
+    SECTION("Memory pool aggregator")
     {
-        typedef moducom::mem::LinkedListPool<int, 10> llpool_t;
-        typedef AllocatorRefHelper<llpool_t> allocator_t;
-        typedef LinkedListPoolNodeTraits<int, 10> node_traits_t;
-        //typedef typename node_traits_t::allocator_t allocator_t;
+        typedef MemoryPoolAggregator<> aggregator_t;
 
-        llpool_t pool;
-        allocator_t allocator(pool);
+        aggregator_t pool;
+        size_t free_before = pool.get_free();
 
-#ifdef UNUSED
-        estd::forward_list<int, node_traits_t> list;
+        IMemory::handle_opaque_t tiny = pool.allocate(8);
+        IMemory::handle_opaque_t small = pool.allocate(20);
+        IMemory::handle_opaque_t large = pool.allocate(1000);
 
-        REQUIRE(list.empty());
+        REQUIRE(aggregator_t::get_handle_class(tiny) == 0);
+        REQUIRE(aggregator_t::get_handle_class(small) == 1);
+        REQUIRE(aggregator_t::get_handle_class(large) == 3);
 
-        list.push_front(5);
+        // all within one class still have small handles of their own
+        REQUIRE(tiny != small);
 
-        REQUIRE(!list.empty());
+        strcpy((char*)pool.lock(tiny), "tiny");
+        strcpy((char*)pool.lock(large), "large");
+        pool.unlock(tiny);
+        pool.unlock(large);
 
-        auto i = list.begin();
+        REQUIRE(strcmp((char*)pool.lock(tiny), "tiny") == 0);
+        REQUIRE(strcmp((char*)pool.lock(large), "large") == 0);
+        pool.unlock(tiny);
+        pool.unlock(large);
 
-        REQUIRE(*i == 5);
-#endif
+        IMemory::handle_opaque_t large_copy = pool.copy(large, 2000, 0);
+
+        REQUIRE(aggregator_t::get_handle_class(large_copy) == 3);
+        REQUIRE(strcmp((char*)pool.lock(large_copy), "large") == 0);
+        pool.unlock(large_copy);
+
+        pool.free(large_copy);
+        pool.free(tiny);
+        pool.free(small);
+        pool.free(large);
+
+        REQUIRE(pool.get_free() == free_before);
 
+        // would otherwise land in class 3 as an all ones inner handle
+        REQUIRE(!pool.free(IMemory::invalid_handle));
+        REQUIRE(!pool.expand(IMemory::invalid_handle, 10));
+        REQUIRE(pool.lock(IMemory::invalid_handle) == NULLPTR);
+        REQUIRE(pool.copy(IMemory::invalid_handle, 10, 0) == IMemory::invalid_handle);
+        REQUIRE(pool.get_free() == free_before);
+
+        SECTION("spills into larger class")
+        {
+            IMemory::handle_opaque_t h;
+
+            // exhaust the 16 byte class
+            while(aggregator_t::get_handle_class(h = pool.allocate(8)) == 0);
+
+            REQUIRE(h != IMemory::invalid_handle);
+            REQUIRE(aggregator_t::get_handle_class(h) == 1);
+        }
     }
-    SECTION("LinkedListPoolNodeTraits 2")
+    SECTION("Compile-time tier memory pool")
     {
-        typedef moducom::mem::LinkedListPool<int, 10> llpool_t;
+        TieredMemoryPool<MemoryPoolIndexed2Tier> pool;
+        TieredMemoryPool<MemoryPoolIndexedTier, 64> pool1;
+        size_t free_before = pool.get_free();
 
-        /* limitation of template template parameter.
-         * still haven't cracked this nut
-        estd::forward_list<int, estd::inlinevalue_node_traits<
-                estd::experimental::forward_node_base,
-                moducom::mem::LinkedListPool<int, 10> >
-                list; */
+        REQUIRE(pool.tier() == IMemory::Indexed2);
+        REQUIRE(pool1.tier() == IMemory::Indexed);
+
+        IMemory::handle_opaque_t h = pool.allocate("hello", 6);
+
+        REQUIRE(h != IMemory::invalid_handle);
+        REQUIRE(strcmp((char*)pool.lock(h), "hello") == 0);
+        pool.unlock(h);
+
+        REQUIRE(pool.expand(h, 200));
+        REQUIRE(strcmp((char*)pool.get_data(h), "hello") == 0);
+
+        // across tiers
+        IMemory::handle_opaque_t h1 = pool1.copy(pool, h, 100);
+
+        REQUIRE(strcmp((char*)pool1.lock(h1), "hello") == 0);
+        pool1.unlock(h1);
+        pool1.free(h1);
+
+        pool.free(h);
+        pool.compact();
+
+        REQUIRE(pool.get_free() == free_before);
+
+        SECTION("IMemory adapter")
+        {
+            IMemoryAdapter<TieredMemoryPool<MemoryPoolIndexed2Tier> > adapter(pool);
+            IMemory& memory = adapter;
+
+            h = memory.allocate(50);
+
+            REQUIRE(h != IMemory::invalid_handle);
+            REQUIRE(pool.get_free() < free_before);
+
+            strcpy((char*)memory.lock(h), "adapted");
+            memory.unlock(h);
+
+            REQUIRE(strcmp((char*)pool.get_data(h), "adapted") == 0);
+
+            memory.free(h);
+
+            REQUIRE(pool.get_free() == free_before);
+        }
     }
-    SECTION("LinkedListPool3")
+    SECTION("Statistics")
     {
-        CONSTEXPR int size = 10;
-        typedef moducom::mem::experimental::LinkedListPool3<int, size> list_t;
+        TieredMemoryPool<MemoryPoolIndexed2Tier> pool;
+        MemoryPoolStats s = pool.stats();
+
+        REQUIRE(s.bytes_in_use == 0);
+        REQUIRE(s.handles_in_use == 0);
+        REQUIRE(s.largest_free_run == s.free_bytes);
+        REQUIRE(s.fragmentation == 0);
+
+        // each exactly 10 pages including PageData header
+        const size_t size = 10 * 32 - 2;
+        IMemory::handle_opaque_t h1 = pool.allocate(size);
+        IMemory::handle_opaque_t h2 = pool.allocate(size);
+        IMemory::handle_opaque_t h3 = pool.allocate(size);
+
+        s = pool.stats();
+
+        REQUIRE(s.handles_in_use == 3);
+        REQUIRE(s.bytes_in_use == 3 * size);
+        REQUIRE(s.high_water_mark == 3 * size);
+
+        pool.free(h2);
+        REQUIRE(pool.expand(h1, size + 1));
+        REQUIRE(pool.allocate(200 * 32) == IMemory::invalid_handle);
+
+        s = pool.stats();
+
+        REQUIRE(s.handles_in_use == 2);
+        REQUIRE(s.bytes_in_use == 2 * size + 32);
+        REQUIRE(s.high_water_mark == 3 * size);
+        REQUIRE(s.allocation_failures == 1);
+        // free space split between a 9 page hole and the tail
+        REQUIRE(s.largest_free_run < s.free_bytes);
+        REQUIRE(s.fragmentation > 0);
+
+        pool.compact();
+
+        s = pool.stats();
+
+        REQUIRE(s.compaction_steps > 0);
+        REQUIRE(s.largest_free_run == s.free_bytes);
+        REQUIRE(s.fragmentation == 0);
+
+        pool.free(h1);
+        pool.free(h3);
+
+        REQUIRE(pool.stats().bytes_in_use == 0);
+
+        SECTION("Index1")
+        {
+            MemoryPool<> pool1;
+
+            h1 = pool1.allocate(100);
+            h2 = pool1.allocate(100);
+
+            pool1.free(h1);
+
+            s = pool1.stats();
+
+            REQUIRE(s.handles_in_use == 1);
+            REQUIRE(s.bytes_in_use == 128);
+            REQUIRE(s.largest_free_run == 32 * (128 - 1) - 2 * 128);
+            REQUIRE(s.free_bytes == s.largest_free_run + 128);
+        }
+    }
+    SECTION("External span")
+    {
+        typedef ExternalMemoryPool<MemoryPoolIndexed2Tier, 32, 64> pool_t;
+
+        static uint8_t span[pool_t::span_size()];
+        static uint8_t span_copy[pool_t::span_size()];
+
+        pool_t pool(span);
+
+        pool.initialize();
+
+        IMemory::handle_opaque_t h = pool.allocate("persistent", 11);
+
+        REQUIRE(pool.get_data(h) >= span);
+        REQUIRE(pool.get_data(h) < span + sizeof(span));
+
+        // pool survives relocation to an entirely different address
+        memcpy(span_copy, span, sizeof(span));
+
+        pool_t reopened(span_copy);
+
+        REQUIRE(reopened.open());
+        REQUIRE(strcmp((char*)reopened.get_data(h), "persistent") == 0);
+        REQUIRE(reopened.get_free() == pool.get_free());
+        REQUIRE(reopened.stats().bytes_in_use == pool.stats().bytes_in_use);
+        REQUIRE(reopened.stats().handles_in_use == 1);
+
+        reopened.free(h);
+
+        REQUIRE(reopened.stats().handles_in_use == 0);
+
+        SECTION("tier mismatch")
+        {
+            ExternalMemoryPool<MemoryPoolIndexedTier, 32, 64> wrong_tier(span);
+
+            REQUIRE(!wrong_tier.open());
+
+            ExternalMemoryPool<MemoryPoolRuntimeTier, 32, 64> runtime_tier(span);
+
+            REQUIRE(runtime_tier.open());
+            REQUIRE(runtime_tier.tier() == IMemory::Indexed2);
+        }
+        SECTION("geometry mismatch")
+        {
+            ExternalMemoryPool<MemoryPoolIndexed2Tier, 64, 32> wrong_page_size(span);
+
+            REQUIRE(!wrong_page_size.open());
+
+            ExternalMemoryPool<MemoryPoolIndexed2Tier, 32, 32> wrong_page_count(span);
+
+            REQUIRE(!wrong_page_count.open());
+
+            RuntimeMemoryPool<uint16_t> wrong_index(span, sizeof(span), 32);
+
+            REQUIRE(!wrong_index.open());
+
+            // unformatted span carries no geometry at all
+            memset(span_copy, 0, sizeof(span_copy));
+
+            REQUIRE(!reopened.open());
+        }
+#ifdef FEATURE_MC_MEM_MMAP
+        SECTION("mapped file")
+        {
+            char path[] = "/tmp/memlib-mapped-XXXXXX";
+            int fd = mkstemp(path);
+
+            REQUIRE(fd >= 0);
+            close(fd);
+
+            {
+                MappedFile file;
+
+                REQUIRE(file.open(path, pool_t::span_size()));
+                REQUIRE(file.created());
+
+                pool_t mapped(file.data());
+
+                mapped.initialize();
+                h = mapped.allocate("mapped", 7);
+
+                REQUIRE(file.sync());
+            }
+
+            MappedFile file;
+
+            REQUIRE(file.open(path, pool_t::span_size()));
+            REQUIRE(!file.created());
+
+            pool_t mapped(file.data());
+
+            REQUIRE(mapped.open());
+            REQUIRE(strcmp((char*)mapped.get_data(h), "mapped") == 0);
+
+            file.close();
+            unlink(path);
+        }
+#endif
+    }
+    SECTION("Runtime sized")
+    {
+        // well beyond 255 pages
+        static uint8_t span[32 * 1024];
+
+        RuntimeMemoryPool<uint16_t> pool(span, sizeof(span), 32);
+
+        REQUIRE(pool.get_page_count() == 1024);
+
+        pool.initialize(8);
+
+        const size_t free_initial = pool.get_free();
+
+        // larger than any uint8_t indexed pool could hand out
+        IMemory::handle_opaque_t big = pool.allocate(16000);
+
+        REQUIRE(big != IMemory::invalid_handle);
+        REQUIRE(pool.get_size(big) >= 16000);
+
+        IMemory::handle_opaque_t small[32];
+
+        for(int i = 0; i < 32; i++)
+        {
+            small[i] = pool.allocate(&i, sizeof(i));
+
+            REQUIRE(small[i] != IMemory::invalid_handle);
+        }
+
+        REQUIRE(pool.allocate(sizeof(span)) == IMemory::invalid_handle);
+
+        // leave holes, then grow past them so relocation and compaction kick in
+        for(int i = 0; i < 32; i += 2) pool.free(small[i]);
+
+        REQUIRE(pool.expand(small[1], 4000));
+
+        // Indexed2 data is only byte aligned
+        int value;
+
+        memcpy(&value, pool.get_data(small[1]), sizeof(value));
+        REQUIRE(value == 1);
+
+        pool.compact();
+
+        for(int i = 3; i < 32; i += 2)
+        {
+            memcpy(&value, pool.get_data(small[i]), sizeof(value));
+            REQUIRE(value == i);
+        }
+
+        for(int i = 1; i < 32; i += 2) pool.free(small[i]);
+
+        pool.free(big);
+        pool.compact();
+
+        REQUIRE(pool.get_free() == free_initial);
+
+        SECTION("stats and allocate_n")
+        {
+            IMemory::handle_opaque_t handles[100];
+
+            REQUIRE(pool.allocate_n(handles, 100, 40) == 100);
+
+            MemoryPoolStats s = pool.stats();
+
+            REQUIRE(s.free_bytes == pool.get_free());
+            REQUIRE(s.largest_free_run <= s.free_bytes);
+#ifdef FEATURE_MC_MEM_POOL_STATS
+            REQUIRE(s.handles_in_use == 100);
+            REQUIRE(s.bytes_in_use == 100 * pool.get_size(handles[0]));
+#endif
+
+            pool.free_n(handles, 100);
+
+            REQUIRE(pool.stats().bytes_in_use == 0);
+        }
+        SECTION("IMemory face")
+        {
+            IMemoryAdapter<RuntimeMemoryPool<uint16_t> > adapter(pool);
+            IMemory& memory = adapter;
+
+            IMemory::handle_opaque_t h = memory.allocate("runtime", 8);
+
+            REQUIRE(h != IMemory::invalid_handle);
+            REQUIRE(strcmp((char*)memory.lock(h), "runtime") == 0);
+            memory.unlock(h);
+            REQUIRE(memory.free(h));
+        }
+        SECTION("same format as MemoryPool")
+        {
+            typedef ExternalMemoryPool<MemoryPoolIndexed2Tier, 32, 64> fixed_pool_t;
+
+            static uint8_t fixed_span[fixed_pool_t::span_size()];
+
+            fixed_pool_t fixed(fixed_span);
+
+            fixed.initialize();
+
+            IMemory::handle_opaque_t h = fixed.allocate("fixed", 6);
+
+            RuntimeMemoryPool<uint8_t> runtime(fixed_span, sizeof(fixed_span), 32);
+
+            REQUIRE(runtime.open());
+            REQUIRE(strcmp((char*)runtime.get_data(h), "fixed") == 0);
+            REQUIRE(runtime.get_free() == fixed.get_free());
+        }
+    }
+    SECTION("Page region")
+    {
+        typedef ExternalMemoryPool<MemoryPoolIndexed2Tier, 32, 64> pool_t;
+
+        PageRegion region;
+
+        // whichever of these the box can't do is quietly dropped
+        REQUIRE(region.allocate(pool_t::span_size(),
+                                PageRegion::TransparentHuge | PageRegion::ExplicitHuge |
+                                PageRegion::BindNode | PageRegion::Populate,
+                                PageRegion::current_node()));
+        REQUIRE(region.data() != NULLPTR);
+        REQUIRE(region.size() == pool_t::span_size());
+
+        // hugetlb page size, when known, is always some multiple of base pages
+        REQUIRE(PageRegion::huge_page_size() % PageRegion::base_page_size() == 0);
+
+        pool_t pool(region.data());
+
+        pool.initialize();
+
+        IMemory::handle_opaque_t h = pool.allocate("region", 7);
+
+        REQUIRE(strcmp((char*)pool.get_data(h), "region") == 0);
+
+        SECTION("ObjStack")
+        {
+            ObjStack os(region.chunk());
+
+            REQUIRE(os.available() == pool_t::span_size());
+            REQUIRE(os.alloc(100) >= (void*)region.data());
+        }
+        SECTION("PoolBase")
+        {
+            typedef PoolBase<TestExplicitPoolItem, 8, ExplicitPoolItemTrait<TestExplicitPoolItem> > items_t;
+
+            PageRegion items_region;
+
+            REQUIRE(items_region.allocate(sizeof(items_t)));
+
+            items_t* items = items_region.construct<items_t>();
+
+            REQUIRE(items != NULLPTR);
+            TestExplicitPoolItem* item;
+
+            REQUIRE(items->count() == 0);
+            REQUIRE(items->allocate_n(&item, 1) == 1);
+            REQUIRE(items->count() == 1);
+
+            items->~items_t();
+        }
+    }
+    SECTION("Batch allocation")
+    {
+        IMemory::handle_opaque_t handles[16];
+
+        SECTION("Index1")
+        {
+            // one page directory only holds 15 handles
+            MemoryPool<> pool(IMemory::Indexed);
+            size_t free_before = pool.get_free();
+
+            REQUIRE(pool.allocate_n(handles, 8, 40) == 8);
+
+            for(int i = 0; i < 8; i++)
+                *(int*)pool.get_data(handles[i]) = i;
+
+            // carved back to back out of one run
+            REQUIRE(pool.get_data(handles[1]) == pool.get_data(handles[0]) + 64);
+
+            for(int i = 0; i < 8; i++)
+                REQUIRE(*(int*)pool.get_data(handles[i]) == i);
+
+            pool.free_n(handles, 8);
+            pool.compact();
+
+            REQUIRE(pool.get_free() == free_before);
+        }
+        SECTION("Index2")
+        {
+            MemoryPool<> pool(IMemory::Indexed2);
+            size_t free_before = pool.get_free();
+
+            REQUIRE(pool.allocate_n(handles, 16, 40) == 16);
+
+            // Indexed2 data is only byte aligned
+            for(int i = 0; i < 16; i++)
+                memcpy(pool.get_data(handles[i]), &i, sizeof(i));
+
+            for(int i = 0; i < 16; i++)
+            {
+                int value;
+
+                memcpy(&value, pool.get_data(handles[i]), sizeof(value));
+                REQUIRE(value == i);
+            }
+
+            pool.free_n(handles, 16);
+
+            REQUIRE(pool.get_free() == free_before);
+            REQUIRE(pool.get_allocated_handle_count() == 0);
+        }
+        SECTION("runs out")
+        {
+            MemoryPool<32, 16> pool(IMemory::Indexed2);
+
+            size_t count = pool.allocate_n(handles, 16, 60);
+
+            REQUIRE(count > 0);
+            REQUIRE(count < 16);
+            REQUIRE(pool.allocate(60) == IMemory::invalid_handle);
+
+            pool.free_n(handles, count);
+        }
+        SECTION("PoolBase")
+        {
+            PoolBase<TestExplicitPoolItem, 8, ExplicitPoolItemTrait<TestExplicitPoolItem> > pool;
+            TestExplicitPoolItem* items[10];
+
+            REQUIRE(pool.allocate_n(items, 3) == 3);
+            REQUIRE(pool.count() == 3);
+            REQUIRE(items[0] != items[1]);
+
+            REQUIRE(pool.allocate_n(items + 3, 7) == 5);
+            REQUIRE(pool.count() == 8);
+
+            pool.free_n(items, 8);
+            REQUIRE(pool.count() == 0);
+        }
+    }
+#ifdef ENABLE_COAP
+    SECTION("Traditional memory pool")
+    {
+        PoolBase<TestToken, 8> pool;
+        TestToken hardcoded;
+
+        hardcoded.set("1234", 4);
+
+        REQUIRE(pool.count() == 0);
+
+        TestToken* allocated = pool.allocate(hardcoded);
+
+        REQUIRE(pool.count() == 1);
+
+        pool.free(allocated);
+
+        REQUIRE(pool.count() == 0);
+    }
+#endif
+    SECTION("Free list pool")
+    {
+        FreeListPool<TestPoolItem, 4> pool;
+
+        REQUIRE(pool.count() == 0);
+        REQUIRE(pool.free() == 4);
+
+        TestPoolItem* item1 = pool.allocate(1);
+        TestPoolItem* item2 = pool.allocate(2);
+
+        REQUIRE(item1 != item2);
+        REQUIRE(item1->value == 1);
+        REQUIRE(item2->is_active());
+        REQUIRE(pool.count() == 2);
+
+        pool.free(item1);
+
+        REQUIRE(pool.count() == 1);
+
+        // most recently freed slot is handed out first
+        REQUIRE(pool.allocate(3) == item1);
+
+        pool.allocate(4);
+        pool.allocate(5);
+
+        REQUIRE(pool.is_full());
+        REQUIRE(pool.allocate(6) == NULLPTR);
+        REQUIRE(pool.free() == 0);
+    }
+    SECTION("Bitmap")
+    {
+        moducom::mem::layer1::Bitmap<200> bitmap;
+
+        REQUIRE(bitmap.count() == 0);
+        REQUIRE(bitmap.find_first_set() == 200);
+        REQUIRE(bitmap.find_first_clear() == 0);
+
+        for(int i = 0; i < 150; i++) bitmap.set(i);
+
+        REQUIRE(bitmap.count() == 150);
+        REQUIRE(bitmap.find_first_clear() == 150);
+
+        bitmap.reset(70);
+
+        REQUIRE(!bitmap.test(70));
+        REQUIRE(bitmap.find_first_clear() == 70);
+
+        for(int i = 0; i < 200; i++) bitmap.set(i);
+
+        REQUIRE(bitmap.count() == 200);
+        REQUIRE(bitmap.find_first_clear() == 200);
+    }
+    SECTION("Bitmap pool")
+    {
+        BitmapPool<TestPoolItem, 70> pool;
+
+        REQUIRE(pool.count() == 0);
+
+        TestPoolItem* item1 = pool.allocate(1);
+        TestPoolItem* item2 = pool.allocate(2);
+
+        REQUIRE(item2 == item1 + 1);
+        REQUIRE(pool.is_allocated(item2));
+        REQUIRE(pool.count() == 2);
+
+        pool.free(item1);
+
+        REQUIRE(!pool.is_allocated(item1));
+        REQUIRE(pool.free() == 69);
+
+        BitmapPool<TestPoolItem, 70>::oobp_t oobp = pool.out_of_band();
+
+        REQUIRE(oobp.allocate(3) == item1);
+        REQUIRE(pool.count() == 2);
+
+        for(int i = 2; i < 70; i++) pool.allocate(i);
+
+        REQUIRE(pool.count() == 70);
+        REQUIRE(pool.allocate(0) == NULLPTR);
+    }
+    SECTION("Object Stack")
+    {
+        moducom::pipeline::layer2::MemoryChunk<512> chunk;
+        ObjStack os(chunk);
+
+        int* val = new (os) int;
+
+        void* buffer = os.alloc(10);
+
+        REQUIRE(os.length() == 512 - sizeof(int) - 10
+#ifdef FEATURE_MC_MEM_OBJSTACK_CHECK
+                               - sizeof(ObjStack::Descriptor) * 2
+#endif
+                                );
+
+#ifdef FEATURE_MC_MEM_OBJSTACK_GNUSTYLE
+        os.free(buffer);
+#else
+        os.free(10);
+#endif
+        os.del(val);
+
+        REQUIRE(os.length() == 512);
+
+        // out of room is reported rather than overrun
+        REQUIRE(os.alloc(512) == NULLPTR);
+        REQUIRE(os.length() == 512);
+
+        SECTION("aligned")
+        {
+            void* odd = os.alloc(3);
+
+            uint8_t* p = (uint8_t*)os.alloc(8, 16);
+
+            REQUIRE((uintptr_t)p % 16 == 0);
+            REQUIRE(p > (uint8_t*)odd);
+
+            double* d = new (os.alloc<double>()) double(1.5);
+
+            REQUIRE((uintptr_t)d % ObjStack::alignment_of<double>() == 0);
+            REQUIRE(*d == 1.5);
+
+            os.alloc(1);
+
+            // placement new aligns by size alone
+            double* d2 = new (os) double(2.5);
+
+            REQUIRE((uintptr_t)d2 % ObjStack::alignment_of<double>() == 0);
+            REQUIRE(ObjStack::alignment_for_size(3) == 1);
+            REQUIRE(ObjStack::alignment_for_size(12) == 4);
+
+            // alignment below that of descriptor still works out
+            os.alloc(1);
+            int16_t* s = (int16_t*)os.alloc(sizeof(int16_t), 2);
+
+            *s = 7;
+            REQUIRE((uintptr_t)s % 2 == 0);
+
+            uint8_t* line = (uint8_t*)os.alloc_cache_line(10);
+
+            REQUIRE((uintptr_t)line % ObjStack::cache_line_size() == 0);
+            // next allocation is pushed past the whole line
+            REQUIRE((uint8_t*)os.alloc(1) >= line + ObjStack::cache_line_size());
+
+            // position is now odd, so padding pushes this past what's left
+            REQUIRE(os.alloc(os.available(), 2) == NULLPTR);
+
+            os.free(odd);
+
+            REQUIRE(os.length() == 512);
+        }
+    }
+    SECTION("Object stack scope")
+    {
+        moducom::pipeline::layer2::MemoryChunk<512> chunk;
+        ObjStack os(chunk);
+        std::vector<int> destroyed;
+
+        struct Tracked
+        {
+            std::vector<int>& destroyed;
+            int id;
+
+            Tracked(std::vector<int>& destroyed, int id) : destroyed(destroyed), id(id) {}
+            ~Tracked() { destroyed.push_back(id); }
+        };
+
+        os.alloc(10);
+
+        const size_t length = os.length();
+
+        {
+            ObjStack::scope outer(os);
+
+            REQUIRE(outer.create<Tracked>(destroyed, 1)->id == 1);
+
+            {
+                ObjStack::scope inner(os);
+
+                inner.create<Tracked>(destroyed, 2);
+                inner.create<Tracked>(destroyed, 3);
+
+                // trivially destructible, no finalizer needed
+                int* i = inner.create<int>(7);
+
+                REQUIRE(*i == 7);
+                REQUIRE((uintptr_t)i % ObjStack::alignment_of<int>() == 0);
+                os.alloc(100);
+            }
+
+            // LIFO, and only inner's
+            REQUIRE(destroyed.size() == 2);
+            REQUIRE(destroyed[0] == 3);
+            REQUIRE(destroyed[1] == 2);
+
+            struct Big { char data[1024]; };
+
+            // out of room leaves stack as it was
+            REQUIRE(outer.create<Big>() == NULLPTR);
+        }
+
+        REQUIRE(destroyed.size() == 3);
+        REQUIRE(destroyed[2] == 1);
+        REQUIRE(os.length() == length);
+
+        SECTION("segmented")
+        {
+            IMemorySegmentProvider provider(Memory::default_pool);
+            SegmentedObjStack<IMemorySegmentProvider> sos(provider, 256);
+
+            sos.alloc(16);
+
+            {
+                SegmentedObjStack<IMemorySegmentProvider>::scope s(sos);
+
+                s.create<Tracked>(destroyed, 4);
+                sos.alloc(200);
+                sos.alloc(200);
+
+                REQUIRE(sos.segment_count() == 3);
+            }
+
+            REQUIRE(destroyed.back() == 4);
+            REQUIRE(sos.segment_count() == 1);
+        }
+    }
+    SECTION("Thread-local arenas")
+    {
+        const size_t arena_size = 4000;
+        PageRegion region;
+
+        REQUIRE(region.allocate(ObjStackArenas::region_size(arena_size, 4)));
+
+        ObjStackArenas arenas(region.data(), arena_size, 4);
+
+        REQUIRE(ObjStackArenas::current() == NULLPTR);
+
+        ObjStack* main_arena = arenas.local();
+
+        REQUIRE(main_arena != NULLPTR);
+        REQUIRE(arenas.local() == main_arena);
+        REQUIRE(ObjStackArenas::current() == main_arena);
+        REQUIRE(main_arena->available() >= arena_size);
+
+        {
+            ObjStack::scope s(*main_arena);
+
+            std::vector<int, ObjStackAllocator<int> > v;
+
+            for(int i = 0; i < 100; i++) v.push_back(i);
+
+            REQUIRE(v[99] == 99);
+
+            std::map<int, int, std::less<int>, ObjStackAllocator<std::pair<const int, int> > > m;
+
+            m[3] = 4;
+
+            REQUIRE(m[3] == 4);
+        }
+
+        REQUIRE(main_arena->available() == arenas.arena_size());
+
+        SECTION("workers")
+        {
+            ObjStack* worker_arenas[3];
+            std::thread workers[3];
+
+            for(int i = 0; i < 3; i++)
+                workers[i] = std::thread([&, i]()
+                {
+                    worker_arenas[i] = arenas.local();
+                    worker_arenas[i]->alloc(10);
+                });
+
+            for(int i = 0; i < 3; i++) workers[i].join();
+
+            // main thread still holds its own
+            for(int i = 0; i < 3; i++)
+                REQUIRE(worker_arenas[i] != main_arena);
+
+            // exiting threads gave their arenas back, emptied
+            for(int i = 0; i < 3; i++)
+                REQUIRE(worker_arenas[i]->available() == arenas.arena_size());
+        }
+        SECTION("second arenas")
+        {
+            PageRegion other_region;
+
+            REQUIRE(other_region.allocate(ObjStackArenas::region_size(arena_size, 1)));
+
+            ObjStackArenas other(other_region.data(), arena_size, 1);
+
+            // thread is bound to arenas, so other hands out none of its own
+            REQUIRE(other.local() == NULLPTR);
+            other.release();
+            REQUIRE(arenas.local() == main_arena);
+
+            arenas.release();
+
+            ObjStack* other_arena = other.local();
+
+            REQUIRE(other_arena != NULLPTR);
+            REQUIRE(other_arena != main_arena);
+            REQUIRE(arenas.local() == NULLPTR);
+
+            other.release();
+        }
+
+        arenas.release();
+
+        REQUIRE(ObjStackArenas::current() == NULLPTR);
+    }
+    SECTION("Segmented object stack")
+    {
+        uint8_t initial[64];
+        IMemorySegmentProvider provider(Memory::default_pool);
+        SegmentedObjStack<IMemorySegmentProvider> os(provider, 256,
+                                                     moducom::pipeline::MemoryChunk(initial, sizeof(initial)));
+
+        void* a = os.alloc(32);
+
+        REQUIRE(a >= (void*)initial);
+        REQUIRE(os.segment_count() == 0);
+
+        // initial chunk can't hold this, so a segment is chained on
+        void* b = os.alloc(48);
+
+        REQUIRE(os.segment_count() == 1);
+
+        int* val = new (os) int(5);
+
+        // larger than segment_size still gets a segment big enough
+        void* c = os.alloc(1000);
+
+        REQUIRE(c != NULLPTR);
+        REQUIRE(os.segment_count() == 2);
+        REQUIRE(*val == 5);
+
+        // rewinding to the start of a segment keeps it, going past it returns it
+        os.free(b);
+
+        REQUIRE(os.segment_count() == 1);
+        REQUIRE(os.alloc(48) == b);
+
+        os.free(a);
+
+        REQUIRE(os.segment_count() == 0);
+        REQUIRE(os.available() == sizeof(initial));
+
+        SECTION("chunk pool")
+        {
+            typedef moducom::mem::experimental::LinkedListPool3<uint8_t[128], 2> pool_t;
+
+            pool_t pool;
+            PoolSegmentProvider<pool_t> pool_provider(pool);
+            SegmentedObjStack<PoolSegmentProvider<pool_t> > pool_os(pool_provider, 0);
+
+            REQUIRE(pool_os.alloc(64) != NULLPTR);
+            REQUIRE(pool_os.alloc(64) != NULLPTR);
+            REQUIRE(pool_os.segment_count() == 2);
+
+            // pool ran dry, and no node is this large anyway
+            REQUIRE(pool_os.alloc(100) == NULLPTR);
+            REQUIRE(pool_os.alloc(1000) == NULLPTR);
+
+            pool_os.clear();
+
+            REQUIRE(pool.alloc() != NULLPTR);
+        }
+        SECTION("byte aligned provider memory")
+        {
+            // Indexed2 data sits 2 bytes into its page
+            MemoryPool<> pool(IMemory::Indexed2);
+            IMemorySegmentProvider pool_provider(pool);
+            size_t free_before = pool.get_free();
+            size_t actual;
+
+            void* segment = pool_provider.allocate(100, &actual);
+
+            REQUIRE(actual == 100);
+            REQUIRE(((uintptr_t)segment & (ObjStack::max_alignment() - 1)) == 0);
+
+            pool_provider.free(segment);
+
+            REQUIRE(pool.get_free() == free_before);
+
+            {
+                SegmentedObjStack<IMemorySegmentProvider> pool_os(pool_provider, 128);
+
+                uint64_t* v = new (pool_os) uint64_t(7);
+
+                REQUIRE(((uintptr_t)v & (alignof(uint64_t) - 1)) == 0);
+                REQUIRE(*v == 7);
+                REQUIRE(pool_os.segment_count() == 1);
+            }
+
+            REQUIRE(pool.get_free() == free_before);
+        }
+    }
+#ifdef FEATURE_MC_MEM_PMR
+    SECTION("Memory resources")
+    {
+        SECTION("object stack")
+        {
+            uint8_t buffer[512];
+            ObjStack os(moducom::pipeline::MemoryChunk(buffer, sizeof(buffer)));
+            ObjStackResource<> resource(os);
+
+            {
+                ObjStack::scope s(os);
+                std::pmr::vector<uint32_t> v(&resource);
+
+                for(uint32_t i = 0; i < 20; i++) v.push_back(i);
+
+                REQUIRE(v[19] == 19);
+                REQUIRE(((uintptr_t)v.data() & (alignof(uint32_t) - 1)) == 0);
+                REQUIRE(os.available() < sizeof(buffer));
+            }
+
+            REQUIRE(os.available() == sizeof(buffer));
+            REQUIRE_THROWS_AS(resource.allocate(1024), std::bad_alloc);
+        }
+        SECTION("node pool")
+        {
+            typedef moducom::mem::experimental::LinkedListPool3<uint8_t[64], 4> pool_t;
+
+            pool_t pool;
+            PoolResource<pool_t> resource(pool);
+
+            void* small = resource.allocate(24, 8);
+
+            REQUIRE(pool.contains(small));
+            REQUIRE(pool.available() == 3);
+
+            // too large for a node, so upstream serves it
+            void* large = resource.allocate(100);
+
+            REQUIRE(!pool.contains(large));
+
+            resource.deallocate(large, 100);
+            resource.deallocate(small, 24, 8);
+
+            REQUIRE(pool.available() == 4);
+
+            {
+                std::pmr::map<int, int> m(&resource);
+
+                // map nodes fit, until pool runs dry and upstream takes over
+                for(int i = 0; i < 10; i++) m[i] = i * 2;
+
+                REQUIRE(pool.available() == 0);
+                REQUIRE(m[9] == 18);
+            }
+
+            REQUIRE(pool.available() == 4);
+        }
+        SECTION("handle pool")
+        {
+            typedef moducom::mem::experimental::LinkedListPool2<uint64_t[8], 2> pool_t;
+
+            pool_t pool;
+            PoolResource<pool_t> resource(pool);
+
+            void* a = resource.allocate(24, 8);
+            void* b = resource.allocate(64, 8);
+
+            REQUIRE(pool.contains(a));
+            REQUIRE(pool.contains(b));
+            REQUIRE(pool.is_full());
+
+            // pool dry, so upstream serves it
+            void* c = resource.allocate(8, 8);
+
+            REQUIRE(!pool.contains(c));
+
+            resource.deallocate(c, 8, 8);
+            resource.deallocate(a, 24, 8);
+            resource.deallocate(b, 64, 8);
+
+            REQUIRE(pool.count_free() == 2);
+        }
+        SECTION("IMemory")
+        {
+            MemoryPool<> pool;
+            IMemoryResource resource(pool);
+            size_t free_before = pool.get_free();
+
+            {
+                std::pmr::vector<uint64_t> v(&resource);
+
+                for(uint64_t i = 0; i < 50; i++) v.push_back(i);
+
+                REQUIRE(v[49] == 49);
+                REQUIRE(((uintptr_t)v.data() & (alignof(uint64_t) - 1)) == 0);
+                REQUIRE(pool.get_free() < free_before);
+            }
+
+            REQUIRE(pool.get_free() == free_before);
+
+            void* p = resource.allocate(16, 32);
+
+            REQUIRE(((uintptr_t)p & 31) == 0);
+
+            resource.deallocate(p, 16, 32);
+
+            REQUIRE(resource.is_equal(IMemoryResource(pool)));
+            REQUIRE_THROWS_AS(resource.allocate(free_before + 1), std::bad_alloc);
+        }
+    }
+#endif
+    SECTION("LinkedListPool")
+    {
+        typedef moducom::mem::LinkedListPool<int, 4> llpool_t;
+        typedef llpool_t::item_t item_t;
+        llpool_t pool;
+
+        int* item = pool.allocate();
+
+        *item = 5;
+
+        const auto& allocated = pool.allocated();
+        auto iterator = allocated.begin();
+
+        REQUIRE(iterator.lock().value() == 5);
+        iterator++;
+        REQUIRE(iterator == allocated.end());
+        REQUIRE(!allocated.empty());
+
+        pool.deallocate(item);
+
+        REQUIRE(allocated.empty());
+    }
+    SECTION("Experimental pool slot management")
+    {
+        typedef int value_type;
+        typedef moducom::mem::experimental::intrusive_node_pool_traits node_traits_t;
+        typedef typename node_traits_t::node_allocator_t<value_type> node_allocator_t;
+        typedef typename node_allocator_t::node_type node_type;
+        // FIX: node_traits behavior in flux, especially allocator.  Disable
+        // this test for now
+#ifdef UNUSED
+        typedef estd::forward_list<value_type, node_traits_t> list2_t;
+
+        list2_t list;
+        node_type value;
+
+        value.value() = 5;
+
+        list.push_front(value);
+
+        // following doesn't quite work yet, compiler tells me I'm
+        // trying to convert int& to intrusive_node_pool_node_type<int>,
+        // but nearly as I can tell we should in fact be starting with intrusive_node_pool_node_type<int>*
+        //REQUIRE(list.front() == 5);
+#endif
+    }
+    SECTION("LinkedListPool as allocator for other linked list")
+    {
+        typedef moducom::mem::LinkedListPool<int, 10> llpool_t;
+        typedef AllocatorRefHelper<llpool_t::item_t> allocator_t;
+#ifdef UNUSED
+        typedef estd::inlinevalue_node_traits<
+                estd::experimental::forward_node_base,
+                AllocatorRefHelper> node_traits_t;
+
+        llpool_t pool;
+        allocator_t allocator();
+
+        // FIX: node_traits behavior in flux, especially allocator.  Disable
+        // this test for now
+        // FIX: allocator_t initialization still clumsy, because we like
+        // having 'empty' allocators we can pass around.  We are
+        // interrupting purely inline value allocators from comfortably
+        // existing
+        estd::forward_list<int, node_traits_t> list(&allocator);
+
+        REQUIRE(list.empty());
+
+        list.push_front(5);
+
+        REQUIRE(!list.empty());
+
+        auto i = list.begin();
+
+        REQUIRE(*i == 5);
+
+        // nearly there, this has a const qualifier drop somewhere
+        //REQUIRE(list.front() == 5);
+#endif
+    }
+    SECTION("Using LinkedListPoolNodeTraits")
+    {
+        typedef moducom::mem::LinkedListPool<int, 10> llpool_t;
+        typedef AllocatorRefHelper<llpool_t> allocator_t;
+        typedef LinkedListPoolNodeTraits<int, 10> node_traits_t;
+        //typedef typename node_traits_t::allocator_t allocator_t;
+
+        llpool_t pool;
+        allocator_t allocator(pool);
+
+#ifdef UNUSED
+        estd::forward_list<int, node_traits_t> list;
+
+        REQUIRE(list.empty());
+
+        list.push_front(5);
+
+        REQUIRE(!list.empty());
+
+        auto i = list.begin();
+
+        REQUIRE(*i == 5);
+#endif
+
+    }
+    SECTION("LinkedListPoolNodeTraits 2")
+    {
+        typedef moducom::mem::LinkedListPool<int, 10> llpool_t;
+
+        /* limitation of template template parameter.
+         * still haven't cracked this nut
+        estd::forward_list<int, estd::inlinevalue_node_traits<
+                estd::experimental::forward_node_base,
+                moducom::mem::LinkedListPool<int, 10> >
+                list; */
+    }
+    SECTION("LinkedListPool3")
+    {
+        CONSTEXPR int size = 10;
+        typedef moducom::mem::experimental::LinkedListPool3<int, size> list_t;
         list_t pool;
         typedef list_t::node_t node_t;
         // we can reuse the forward_node_base portion to construct our own 'allocated'
@@ -407,5 +1878,117 @@ TEST_CASE("Low-level memory pool tests", "[mempool-low]")
         pool.free(node);
         pool.free(node2);
         REQUIRE(pool.available() == 10);
+
+        SECTION("batch")
+        {
+            node_t* nodes[size + 1];
+
+            REQUIRE(pool.allocate_n(nodes, 4) == 4);
+            REQUIRE(pool.available() == 6);
+
+            pool.free_n(nodes, 4);
+            REQUIRE(pool.available() == 10);
+
+            // freed chain comes back in same order
+            REQUIRE(pool.alloc() == nodes[0]);
+            pool.free(nodes[0]);
+
+            REQUIRE(pool.allocate_n(nodes, size + 1) == size);
+            REQUIRE(pool.alloc() == NULLPTR);
+
+            pool.free_n(nodes, size);
+            REQUIRE(pool.available() == 10);
+        }
+    }
+    SECTION("ConcurrentLinkedListPool3")
+    {
+        CONSTEXPR int size = 64;
+        typedef moducom::mem::experimental::ConcurrentLinkedListPool3<int, size> pool_t;
+        typedef pool_t::node_t node_t;
+        pool_t pool;
+
+        node_t* node = pool.alloc();
+        node_t* node2 = pool.alloc();
+
+        REQUIRE(node != node2);
+        REQUIRE(pool.available() == size - 2);
+
+        pool.free(node);
+
+        // LIFO, so most recently freed node comes right back
+        REQUIRE(pool.alloc() == node);
+
+        pool.free(node);
+        pool.free(node2);
+
+        SECTION("exhaustion")
+        {
+            node_t* nodes[size];
+
+            for(int i = 0; i < size; i++) nodes[i] = pool.alloc();
+
+            REQUIRE(pool.alloc() == NULLPTR);
+
+            for(int i = 0; i < size; i++) pool.free(nodes[i]);
+
+            REQUIRE(pool.available() == size);
+        }
+        SECTION("batch")
+        {
+            node_t* nodes[size];
+
+            REQUIRE(pool.allocate_n(nodes, 16) == 16);
+            REQUIRE(pool.available() == size - 16);
+
+            pool.free_n(nodes, 16);
+
+            REQUIRE(pool.alloc() == nodes[0]);
+            pool.free(nodes[0]);
+
+            REQUIRE(pool.allocate_n(nodes, size) == size);
+            REQUIRE(pool.allocate_n(nodes, 1) == 0);
+
+            pool.free_n(nodes, size);
+            REQUIRE(pool.available() == size);
+        }
+        SECTION("multiple threads")
+        {
+            std::thread threads[4];
+            bool ok[4];
+
+            for(int t = 0; t < 4; t++)
+            {
+                threads[t] = std::thread([&pool, &ok, t]()
+                {
+                    node_t* nodes[16];
+
+                    ok[t] = true;
+
+                    for(int round = 0; round < 1000; round++)
+                    {
+                        for(int i = 0; i < 16; i++)
+                        {
+                            nodes[i] = pool.alloc();
+                            nodes[i]->value = t;
+                        }
+
+                        // nobody else may have been handed our nodes
+                        for(int i = 0; i < 16; i++)
+                        {
+                            ok[t] &= nodes[i]->value == t;
+                            pool.free(nodes[i]);
+                        }
+                    }
+                });
+            }
+
+            for(int t = 0; t < 4; t++)
+            {
+                threads[t].join();
+                REQUIRE(ok[t]);
+            }
+
+            REQUIRE(pool.available() == size);
+        }
     }
 }
@@ -2,13 +2,32 @@
 #include <catch.hpp>
 
 #include "MemoryPool.h"
+#include "mc/memory-sharded.h"
+#include "mc/memory-trace.h"
 //#include "mc/string.h"
 
+#include <thread>
+
 // Not really using it, and isn't behaving on macOS
 //#include <malloc.h>
 
 using namespace moducom::dynamic;
 
+// collects trace output for inspection
+struct BufferTraceWriter
+{
+    uint8_t buffer[256];
+    size_t len;
+
+    BufferTraceWriter() : len(0) {}
+
+    void write(const uint8_t* data, size_t n)
+    {
+        memcpy(buffer + len, data, n);
+        len += n;
+    }
+};
+
 struct Tester1
 {
     char t[10];
@@ -82,4 +101,165 @@ TEST_CASE("General memory tests", "[memory]")
 
         delete memory;
     }
+    SECTION("Sharded memory")
+    {
+        typedef ShardedMemory<> sharded_t;
+
+        // extra directory pages so handles outnumber what threads hold at once
+        MemoryPool<> pool1(IMemory::Indexed2, 4), pool2(IMemory::Indexed2, 4);
+        IMemory* pools[] = { &pool1, &pool2 };
+        sharded_t memory(pools, 2);
+
+        IMemory::handle_opaque_t h = memory.allocate("Hi", 10, 3);
+
+        REQUIRE(h != IMemory::invalid_handle);
+        REQUIRE(sharded_t::get_handle_class(h) == 1);
+        REQUIRE(strcmp((char*)memory.lock(h), "Hi") == 0);
+        memory.unlock(h);
+
+        size_t free_before = pool1.get_free() + pool2.get_free();
+
+        // lands in thread cache, so underlying pool still holds it
+        memory.free(h);
+
+        REQUIRE(pool1.get_free() + pool2.get_free() == free_before);
+        REQUIRE(memory.allocate(12) == h);
+
+        memory.free(h);
+        memory.flush();
+
+        REQUIRE(pool1.get_free() + pool2.get_free() > free_before);
+
+        SECTION("Uncached sizes")
+        {
+            IMemory::handle_opaque_t large = memory.allocate(2000);
+
+            REQUIRE(sharded_t::get_handle_class(large) == 0);
+            REQUIRE(memory.free(large));
+        }
+        SECTION("Invalid and locked handles")
+        {
+            // decodes as size class 7 of the last shard, neither of which we have
+            REQUIRE(!memory.free(IMemory::invalid_handle));
+            REQUIRE(memory.lock(IMemory::invalid_handle) == NULLPTR);
+            REQUIRE(!memory.expand(IMemory::invalid_handle, 10));
+            REQUIRE(memory.allocate(1000) != IMemory::invalid_handle);
+
+            IMemory::handle_opaque_t other_shard = (IMemory::handle_opaque_t)5 << sharded_t::shard_shift;
+
+            REQUIRE(!memory.free(other_shard));
+
+            memory.flush();
+
+            IMemory::handle_opaque_t locked = memory.allocate(20);
+            IMemory::handle_opaque_t h2 = memory.allocate(20);
+            size_t free_before = pool1.get_free() + pool2.get_free();
+
+            // with a lock outstanding, frees skip the cache so shard can refuse locked ones
+            memory.lock(locked);
+            REQUIRE(memory.free(h2));
+            REQUIRE(pool1.get_free() + pool2.get_free() > free_before);
+            memory.unlock(locked);
+            REQUIRE(memory.free(locked));
+        }
+        SECTION("Multiple threads")
+        {
+            std::thread threads[4];
+            bool ok[4];
+
+            for(int t = 0; t < 4; t++)
+            {
+                threads[t] = std::thread([&memory, &ok, t]()
+                {
+                    IMemory::handle_opaque_t handles[16];
+
+                    ok[t] = true;
+
+                    for(int round = 0; round < 50; round++)
+                    {
+                        for(int i = 0; i < 16; i++)
+                        {
+                            handles[i] = memory.allocate(sizeof(int) * (1 + i % 4));
+
+                            if(handles[i] == IMemory::invalid_handle) { ok[t] = false; return; }
+
+                            int value = t * 100 + i;
+
+                            // Indexed2 data is only byte aligned
+                            memcpy(memory.lock(handles[i]), &value, sizeof(value));
+                            memory.unlock(handles[i]);
+                        }
+
+                        for(int i = 0; i < 16; i++)
+                        {
+                            int value;
+
+                            memcpy(&value, memory.lock(handles[i]), sizeof(value));
+                            ok[t] &= value == t * 100 + i;
+                            memory.unlock(handles[i]);
+                            memory.free(handles[i]);
+                        }
+                    }
+                });
+            }
+
+            for(int t = 0; t < 4; t++)
+            {
+                threads[t].join();
+                REQUIRE(ok[t]);
+            }
+        }
+    }
+    SECTION("Trace recording")
+    {
+        MemoryPool<> pool(IMemory::Indexed2);
+        BufferTraceWriter writer;
+        TracingMemory<BufferTraceWriter> memory(pool, writer);
+
+        IMemory::handle_opaque_t h = memory.allocate(300);
+
+        memory.lock(h);
+        memory.unlock(h);
+        memory.shrink(h, 100);
+        // more than the whole pool, so recorded as failed
+        REQUIRE(!memory.expand(h, 100000));
+        memory.free(h);
+
+        REQUIRE(memcmp(writer.buffer, MemoryTrace::magic(), 4) == 0);
+        REQUIRE(writer.buffer[4] == MemoryTrace::version);
+
+        const MemoryTrace::TraceOp expected[] =
+        {
+            MemoryTrace::Allocate, MemoryTrace::Lock, MemoryTrace::Unlock,
+            MemoryTrace::Shrink, MemoryTrace::Expand, MemoryTrace::Free
+        };
+        size_t pos = 5;
+
+        for(int i = 0; i < 6; i++)
+        {
+            MemoryTrace::Record r;
+            size_t consumed = MemoryTrace::decode(writer.buffer + pos, writer.len - pos, &r);
+
+            REQUIRE(consumed > 0);
+            REQUIRE(r.op == expected[i]);
+            REQUIRE(r.handle == h);
+
+            if(i == 0) REQUIRE(r.size == 300);
+            if(i == 3) REQUIRE(r.size == 100);
+            REQUIRE(r.failed == (i == 4));
+
+            pos += consumed;
+        }
+
+        REQUIRE(pos == writer.len);
+
+        uint8_t varint[10];
+        uint64_t decoded;
+
+        REQUIRE(MemoryTrace::encode_varint(300, varint) == 2);
+        REQUIRE(MemoryTrace::decode_varint(varint, 2, &decoded) == 2);
+        REQUIRE(decoded == 300);
+        // truncated
+        REQUIRE(MemoryTrace::decode_varint(varint, 1, &decoded) == 0);
+    }
 }